@@ -0,0 +1,268 @@
+// headless batch front end
+// generates a range of levels of one seed on every core and writes them to
+// a file or stdout. No terminal dependency, so it can run from build scripts
+
+#include <pthread.h>
+#include "rl.h"
+
+#define OUTBUF		(1 << 16)	// stdio buffer for the output file
+#define HEADER_MAX	96			// longest level header line
+
+// output formats
+enum { OUT_TEXT, OUT_PACK, OUT_RLE };
+
+// shared state of one batch run
+struct batch {
+	uint64_t seed, first;   // levels first .. first + count - 1 of seed
+	long count;
+	bool ordered;           // write levels in order rather than as they finish
+	int format;             // OUT_TEXT, or a level pack with raw or run length tiles
+	struct dungeon *scratch; // one dungeon per worker, reused between levels
+	char **text;            // one text buffer per worker, or per level when ordered
+	size_t *len;            // ordered: bytes of each level's text
+	size_t textsize;        // size of a level's text
+	long next;              // ordered: next level to write
+	uint64_t written;       // bytes written so far
+	uint64_t *index;        // packs: where each level's record was written
+	FILE *fp;
+	pthread_mutex_t lock;   // guards fp, next, written and the per level text
+};
+
+void usage(char *name); // prints the command line options
+int parse_format(const char *name); // output format for a name given on the command line, INVALID if unknown
+void batch_level(void *ctx, int worker, long i); // generates and writes one level
+void batch_write(struct batch *b, long i, char *text, size_t len); // hands a finished level to the output
+void batch_emit(struct batch *b, long i, char *text, size_t len); // writes one level
+
+int main(int argc, char *argv[])
+{
+	struct batch b;
+	int height = HEIGHT_DEFAULT, width = WIDTH_DEFAULT, layout = LAYOUT_ROWS;
+	int threads = sched_cores();
+	int pathfinder = PF_ASTAR, planner = PLAN_CHAIN, placement = PLACE_SCATTER, density = 0, corridors = CORR_SERIAL;
+	bool timing = false;
+	char *path = NULL;
+	struct timespec t0, t1;
+	double secs;
+	long searched = 0, reruns = 0;
+	int opt, i;
+
+	memset(&b, 0, sizeof(b));
+	b.count = 1;
+	b.ordered = true;
+	b.fp = stdout;
+	while ((opt = getopt(argc, argv, "h:w:l:p:c:r:d:e:f:s:k:n:j:o:ut")) != -1)
+		switch (opt)
+		{
+			case 'h': height = atoi(optarg); break;
+			case 'w': width = atoi(optarg); break;
+			case 'l': layout = parse_layout(optarg); break;
+			case 'p': pathfinder = parse_pathfinder(optarg); break;
+			case 'c': planner = parse_planner(optarg); break;
+			case 'r': placement = parse_placement(optarg); break;
+			case 'd': density = atoi(optarg); break;
+			case 'e': corridors = parse_corridors(optarg); break;
+			case 'f': b.format = parse_format(optarg); break;
+			case 's': b.seed = strtoull(optarg, NULL, 10); break;
+			case 'k': b.first = strtoull(optarg, NULL, 10); break;
+			case 'n': b.count = strtol(optarg, NULL, 10); break;
+			case 'j': threads = atoi(optarg); break;
+			case 'o': path = optarg; break;
+			case 'u': b.ordered = false; break;
+			case 't': timing = true; break;
+			default: usage(argv[0]); return 1;
+		}
+	if (threads < 1 || b.count < 0 || layout == INVALID || pathfinder == INVALID || planner == INVALID ||
+			placement == INVALID || corridors == INVALID || b.format == INVALID || (density && set_density(density) == FAILURE))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	set_pathfinder(pathfinder);
+	set_planner(planner);
+	set_placement(placement);
+	set_corridors(corridors);
+	if (threads > b.count && b.count > 0)
+	{ // no point starting idle workers, the threads left search corridors ahead
+		set_lookahead(threads / b.count);
+		threads = b.count;
+	}
+
+	if (!(b.scratch = calloc(threads, sizeof(struct dungeon))))
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < threads; i++)
+		if (dungeon_init(&b.scratch[i], height, width, layout) == FAILURE)
+		{
+			fprintf(stderr, "map must be between %dx%d and %dx%d\n", MAP_MIN, MAP_MIN, MAP_MAX, MAP_MAX);
+			return 1;
+		}
+	b.textsize = HEADER_MAX + height * (width + 1) + 1;
+	if (b.format != OUT_TEXT && !(b.index = malloc((b.count ? b.count : 1) * sizeof(uint64_t))))
+	{
+		fprintf(stderr, "out of memory for the index of %ld levels\n", b.count);
+		return 1;
+	}
+	if (b.ordered)
+	{
+		b.text = calloc(b.count ? b.count : 1, sizeof(char *)); // filled as levels finish, freed as written
+		b.len = calloc(b.count ? b.count : 1, sizeof(size_t));
+		if (!b.text || !b.len)
+		{
+			fprintf(stderr, "out of memory to order %ld levels, try -u\n", b.count);
+			return 1;
+		}
+	}
+	else if (b.format == OUT_TEXT)
+	{
+		if (!(b.text = calloc(threads, sizeof(char *))))
+		{
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		for (i = 0; i < threads; i++)
+			if (!(b.text[i] = malloc(b.textsize)))
+			{
+				fprintf(stderr, "out of memory for a %dx%d level\n", width, height);
+				return 1;
+			}
+	}
+	if (path && (b.fp = fopen(path, "w")) == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+	setvbuf(b.fp, NULL, _IOFBF, OUTBUF);
+	pthread_mutex_init(&b.lock, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (b.format != OUT_TEXT)
+		b.written = pack_begin(b.fp);
+	sched_run(threads, b.count, batch_level, &b);
+	if (b.format != OUT_TEXT)
+		pack_end(b.fp, b.index, b.count, b.written);
+	fflush(b.fp);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (timing)
+	{
+		secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		fprintf(stderr, "%ld levels in %.3f s on %d threads, %.1f levels/s\n",
+				b.count, secs, threads, b.count / secs);
+		for (i = 0; i < threads; i++)
+			speculate_stats(&b.scratch[i], &searched, &reruns);
+		if (searched)
+			fprintf(stderr, "%ld corridors searched ahead, %ld (%.1f%%) run again\n",
+					searched, reruns, 100.0 * reruns / searched);
+	}
+	if (b.fp != stdout)
+		fclose(b.fp);
+	pthread_mutex_destroy(&b.lock);
+	if (!b.ordered && b.format == OUT_TEXT)
+		for (i = 0; i < threads; i++)
+			free(b.text[i]);
+	free(b.text);
+	free(b.len);
+	free(b.index);
+	for (i = 0; i < threads; i++)
+		dungeon_free(&b.scratch[i]);
+	free(b.scratch);
+	return 0;
+}
+
+// generates level first + i on the worker's own dungeon and writes it out.
+// Each level has its own generator, so the result doesn't depend on the worker
+void batch_level(void *ctx, int worker, long i)
+{
+	struct batch *b = ctx;
+	struct dungeon *d = &b->scratch[worker];
+	char *text;
+	size_t len;
+
+	generate(d, b->seed, b->first + i);
+	if (b->format != OUT_TEXT)
+	{ // a pack record, always a buffer of its own
+		text = (char *) pack_dungeon(d, b->format == OUT_RLE ? PACK_RLE : PACK_RAW, &len);
+		batch_write(b, i, text, len);
+		return;
+	}
+	text = b->ordered ? malloc(b->textsize) : b->text[worker];
+	len = snprintf(text, HEADER_MAX, "seed %" PRIu64 " level %" PRIu64 " %dx%d\n",
+			d->seed, d->level, d->grid.width, d->grid.height);
+	len += sprintMap(text + len, &d->grid, d->map);
+	text[len++] = '\n';
+	text[len] = '\0';
+	batch_write(b, i, text, len);
+	return;
+}
+
+// hands a finished level to the output. Unordered levels are written straight
+// away. Ordered levels wait for the ones before them, and whoever finishes the
+// next level due writes every consecutive level that is ready
+void batch_write(struct batch *b, long i, char *text, size_t len)
+{
+	pthread_mutex_lock(&b->lock);
+	if (!b->ordered)
+	{
+		batch_emit(b, i, text, len);
+		if (b->format != OUT_TEXT)
+			free(text); // text buffers belong to the worker
+	}
+	else
+	{
+		b->text[i] = text;
+		b->len[i] = len;
+		while (b->next < b->count && b->text[b->next])
+		{
+			batch_emit(b, b->next, b->text[b->next], b->len[b->next]);
+			free(b->text[b->next]);
+			b->text[b->next++] = NULL;
+		}
+	}
+	pthread_mutex_unlock(&b->lock);
+	return;
+}
+
+// writes level i, noting where it went for a pack's index
+void batch_emit(struct batch *b, long i, char *text, size_t len)
+{
+	if (b->index)
+		b->index[i] = b->written;
+	fwrite(text, 1, len, b->fp);
+	b->written += len;
+	return;
+}
+
+// output format for a name given on the command line, INVALID if unknown
+int parse_format(const char *name)
+{
+	if (strcmp(name, "text") == 0)
+		return OUT_TEXT;
+	else if (strcmp(name, "pack") == 0)
+		return OUT_PACK;
+	else if (strcmp(name, "rle") == 0)
+		return OUT_RLE;
+	return INVALID;
+}
+
+// prints the command line options
+void usage(char *name)
+{
+	fprintf(stderr, "usage: %s [-h height] [-w width] [-l rows|tiles] [-p astar|jps] [-c chain|mst|loops] [-r scatter|packed] [-d density]\n"
+			"       [-e serial|batch|speculate] [-s seed] [-k first level] [-n count] [-j threads] [-f text|pack|rle] [-o file] [-u] [-t]\n", name);
+	fprintf(stderr, "  generates levels first level .. first level + count - 1 of seed\n");
+	fprintf(stderr, "  -l stores cells row by row (default) or in 8x8 tiles\n");
+	fprintf(stderr, "  -p finds corridors with astar (default) or jump point search\n");
+	fprintf(stderr, "  -c joins rooms in a chain (default), a minimum spanning tree, or the tree with extra loops\n");
+	fprintf(stderr, "  -r places a few rooms at random (default) or packs rooms until -d percent of the map is covered\n");
+	fprintf(stderr, "  -e digs each corridor in turn (default), searches them all at once over the map before any is dug,\n"
+			"     or digs in turn with the searches run ahead, the same level as the default. Searches run\n"
+			"     ahead on the threads -j leaves over once every level has one, so only when -n is below -j\n");
+	fprintf(stderr, "  -j runs on that many threads, all cores by default\n");
+	fprintf(stderr, "  -f writes levels as text (default) or a binary level pack, tiles raw or run length encoded\n");
+	fprintf(stderr, "  -u writes levels as they finish instead of in order, each is tagged by its header\n");
+	fprintf(stderr, "  -o writes to file instead of stdout, -t reports throughput on stderr\n");
+	return;
+}
@@ -0,0 +1,131 @@
+/******************************************************************************
+
+Bitboards
+
+One bit per map cell, stored as rows of 64 bit words in y, x order whatever
+the layout of the map itself. Room placement keeps one as an occupancy layer
+so a whole room-plus-spacer rectangle is tested or stamped with a mask per
+word of each row, instead of a key lookup per cell. With AVX2 four rows are
+tested per instruction.
+
+*******************************************************************************/
+
+#include "rl.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* #################### FUNCTIONS ############################### */
+bool bitboard_clip(const struct bitboard *b, int *y, int *x, int *height, int *width); // clips a rectangle to the board
+uint64_t wordmask(int w, int x0, int x1); // bits of word w covered by columns x0 .. x1 - 1
+/* ############################################################## */
+
+// allocates a cleared board for a height x width map
+bool bitboard_init(struct bitboard *b, int height, int width)
+{
+    b->height = height;
+    b->width = width;
+    b->words = (width + 63) / 64;
+    b->bits = calloc(height * b->words, sizeof(uint64_t));
+    return b->bits ? SUCCESS : FAILURE;
+}
+
+// frees the board's bits
+void bitboard_free(struct bitboard *b)
+{
+    free(b->bits);
+    b->bits = NULL;
+    return;
+}
+
+// clears every bit
+void bitboard_clear(struct bitboard *b)
+{
+    memset(b->bits, 0, b->height * b->words * sizeof(uint64_t));
+    return;
+}
+
+// returns whether any cell of the rectangle at y, x is set. The parts of
+// the rectangle off the board are ignored
+bool bitboard_test(const struct bitboard *b, int y, int x, int height, int width)
+{
+    const uint64_t *row;
+    uint64_t mask, acc = 0;
+    int w, r, stride = b->words;
+
+    if (!bitboard_clip(b, &y, &x, &height, &width))
+        return false;
+    for (w = x / 64; w <= (x + width - 1) / 64; w++)
+    { // one word column at a time, rooms rarely span more than two
+        mask = wordmask(w, x, x + width);
+        row = b->bits + y * stride + w;
+        r = 0;
+#ifdef __AVX2__
+        for (; r + 4 <= height; r += 4, row += 4 * stride)
+        { // four rows of the column against the mask in one test
+            __m256i v = _mm256_set_epi64x(row[3 * stride], row[2 * stride], row[stride], row[0]);
+            if (!_mm256_testz_si256(v, _mm256_set1_epi64x(mask)))
+                return true;
+        }
+#endif
+        for (; r < height; r++, row += stride)
+            acc |= *row & mask; // no branch per row, one test at the end
+    }
+    return acc != 0;
+}
+
+// sets every cell of the rectangle at y, x, ignoring the parts off the board
+void bitboard_set(struct bitboard *b, int y, int x, int height, int width)
+{
+    uint64_t *row;
+    uint64_t mask;
+    int w, r;
+
+    if (!bitboard_clip(b, &y, &x, &height, &width))
+        return;
+    for (w = x / 64; w <= (x + width - 1) / 64; w++)
+    {
+        mask = wordmask(w, x, x + width);
+        row = b->bits + y * b->words + w;
+        for (r = 0; r < height; r++, row += b->words)
+            *row |= mask;
+    }
+    return;
+}
+
+// returns whether the cell at y, x is set
+bool bitboard_get(const struct bitboard *b, int y, int x)
+{
+    return b->bits[y * b->words + x / 64] >> (x % 64) & 1;
+}
+
+// clips a rectangle to the board, FAILURE if nothing is left
+bool bitboard_clip(const struct bitboard *b, int *y, int *x, int *height, int *width)
+{
+    if (*y < 0)
+    {
+        *height += *y;
+        *y = 0;
+    }
+    if (*x < 0)
+    {
+        *width += *x;
+        *x = 0;
+    }
+    if (*y + *height > b->height)
+        *height = b->height - *y;
+    if (*x + *width > b->width)
+        *width = b->width - *x;
+    return *height > 0 && *width > 0;
+}
+
+// returns the bits of word w that columns x0 .. x1 - 1 cover
+uint64_t wordmask(int w, int x0, int x1)
+{
+    int lo = x0 > w * 64 ? x0 - w * 64 : 0;
+    int hi = x1 < (w + 1) * 64 ? x1 - w * 64 : 64;
+
+    if (hi - lo == 64)
+        return ~(uint64_t) 0;
+    return (((uint64_t) 1 << (hi - lo)) - 1) << lo;
+}
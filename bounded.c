@@ -0,0 +1,346 @@
+/******************************************************************************
+
+Bounded searches
+
+astar runs until it reaches the stop or has flooded everything it can
+reach, however long that takes. For queries in a game's tick loop
+search_bounded takes a budget, a number of cells to expand and/or a time
+limit, and always returns within it with the best it has and a status:
+
+    BS_FOUND        a path to the stop, at most bound percent of the cheapest
+    BS_PARTIAL      the budget ran out: a path to the reached cell nearest
+                    the stop, to walk while the query runs again next tick
+    BS_UNREACHABLE  there is no path
+
+Modes:
+
+    BS_ASTAR        A* with the manhattan distance to the stop, exact
+    BS_WEIGHTED     the distance counts weight percent, so the search heads
+                    for the stop sooner; paths cost at most weight percent
+                    of the cheapest
+    BS_BIDIR        Dijkstra from both ends at once, meeting in the middle,
+                    exact. A stop walled in is found out from its side
+                    quickly instead of by flooding from the start
+    BS_ANYTIME      weighted first, then again with the weight halved
+                    towards 100, each round pruned by the best path so far,
+                    until the budget runs out or the path is the cheapest
+
+Moves are the 4 directions astar uses, costing the cell entered.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+#define CLOCK_EVERY 64      // expansions between looks at the clock
+
+// state of one bounded search
+struct bounded {
+    struct search *s;
+    const struct grid *g;
+    const uint8_t *cost;
+    int start, stop;
+    struct budget *b;
+    struct timespec deadline;
+    int near;               // expanded cell nearest the stop
+};
+
+/* #################### FUNCTIONS ############################### */
+int bounded_forward(struct bounded *r, int weight, int limit); // one weighted A* pass
+int bounded_bidir(struct bounded *r); // Dijkstra from both ends
+bool bounded_spent(struct bounded *r); // counts an expansion, has the budget run out?
+void bounded_nearer(struct bounded *r, int key); // keeps the expanded cell nearest the stop
+bool walled(const struct grid *g, const uint8_t moveCost[], int key); // is the cell blocked or all its neighbours?
+void bounded_copy(struct bounded *r, int key, struct path *p); // copies the path to key into p
+/* ############################################################## */
+
+// searches from start to stop in b->mode within b's budget and copies the
+// path into p as search_path does. Returns BS_FOUND with b->bound set,
+// BS_PARTIAL with a path towards the stop, or BS_UNREACHABLE with p->len 0.
+// b->expanded counts the cells expanded. If p is short its len is past its
+// cap and, but for BS_ANYTIME, search_path can copy the path again to
+// p->keys[p->len - 1] before s searches again
+int search_bounded(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop,
+                   struct budget *b, struct path *p)
+{
+    struct bounded r = { .s = s, .g = g, .cost = moveCost, .start = start, .stop = stop, .b = b };
+    int weight = b->weight > 100 ? b->weight : 100, best = MAX_STEPS;
+    int status = BS_UNREACHABLE, round;
+
+    p->len = p->cost = 0;
+    b->expanded = 0;
+    b->bound = 100;
+    if (b->usec > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &r.deadline);
+        r.deadline.tv_sec += b->usec / 1000000;
+        r.deadline.tv_nsec += b->usec % 1000000 * 1000;
+        if (r.deadline.tv_nsec >= 1000000000)
+        {
+            r.deadline.tv_sec++;
+            r.deadline.tv_nsec -= 1000000000;
+        }
+    }
+    if (start != stop && (walled(g, moveCost, start) || walled(g, moveCost, stop)))
+        return BS_UNREACHABLE; // no search needed
+    if (!s->closed && !(s->closed = calloc(s->size, sizeof(uint32_t))))
+        return BS_UNREACHABLE;
+
+    switch (b->mode)
+    {
+        case BS_BIDIR:
+            if (search_back(s) == FAILURE)
+                return BS_UNREACHABLE;
+            status = bounded_bidir(&r);
+            break;
+        case BS_ANYTIME:
+            for (;;)
+            {
+                round = bounded_forward(&r, weight, best);
+                if (round == BS_FOUND)
+                { // a cheaper path, within weight of the cheapest
+                    bounded_copy(&r, stop, p);
+                    best = p->cost;
+                    b->bound = weight;
+                    status = BS_FOUND;
+                }
+                else if (round == BS_UNREACHABLE)
+                { // nothing a weight cheaper than the best exists
+                    b->bound = weight;
+                    break;
+                }
+                else
+                {
+                    if (status != BS_FOUND)
+                        status = BS_PARTIAL;
+                    break;
+                }
+                if (weight == 100)
+                    break; // that was plain A*
+                weight = 100 + (weight - 100) / 2;
+            }
+            if (status == BS_PARTIAL)
+                bounded_copy(&r, r.near, p);
+            return status;
+        default:
+            status = bounded_forward(&r, b->mode == BS_WEIGHTED ? weight : 100, MAX_STEPS);
+            b->bound = b->mode == BS_WEIGHTED ? weight : 100;
+            break;
+    }
+    if (status != BS_UNREACHABLE)
+        bounded_copy(&r, status == BS_FOUND ? stop : r.near, p);
+    return status;
+}
+
+// one pass of A* with the distance to the stop counted weight percent,
+// skipping cells that can't lead to a path cheaper than limit. A cell is
+// expanded once: a cheaper way to it found later isn't followed, which
+// keeps paths within weight of the cheapest (the distance never drops by
+// more than a move costs) without weighted searches going over the same
+// ground again and again. At 100 it never happens. Returns
+// BS_FOUND once the stop is expanded, BS_PARTIAL if the budget runs out
+// first, BS_UNREACHABLE if there is nothing left to expand
+int bounded_forward(struct bounded *r, int weight, int limit)
+{
+    struct search *s = r->s;
+    const struct grid *g = r->g;
+    int u, v, i, cost, left, status = BS_UNREACHABLE;
+
+    search_reset(s);
+    search_visit(s, r->start, 0, INVALID);
+    pqueue_push(&s->open, r->start, howfar(g, r->start, r->stop) * weight / 100);
+    r->near = r->start;
+    while ((u = pqueue_pop(&s->open)) != INVALID)
+    {
+        if (u == r->stop)
+        {
+            status = BS_FOUND;
+            break;
+        }
+        if (bounded_spent(r))
+        {
+            status = BS_PARTIAL;
+            break;
+        }
+        bounded_nearer(r, u);
+        s->closed[u] = s->gen;
+        for (i = 1; i < CARDINALS; i++)
+        {
+            v = offsetkey(g, u, y(i), x(i));
+            if (v == INVALID || r->cost[v] == COST_BLOCKED || s->closed[v] == s->gen)
+                continue;
+            cost = s->costTo[u] + r->cost[v];
+            left = howfar(g, v, r->stop); // never more than the cost left, a move costs at least 1
+            if (cost >= search_cost(s, v) || cost + left >= limit)
+                continue;
+            search_visit(s, v, cost, u);
+            pqueue_push(&s->open, v, cost + left * weight / 100);
+        }
+    }
+    pqueue_purge(&s->open);
+    return status;
+}
+
+// Dijkstra from the start forwards and from the stop backwards, expanding
+// the side with the smaller open set. Every cell both sides reach offers a
+// path; once the costs of the last cells the two sides expanded add up to
+// the cheapest offered no cheaper path is left. The path is left in the
+// workspace's cameFrom for search_path, the backward half spliced on
+// where they met
+int bounded_bidir(struct bounded *r)
+{
+    struct search *s = r->s;
+    const struct grid *g = r->g;
+    int u, v, i, cost, via, best = MAX_STEPS, meet = INVALID;
+    int lastfore = 0, lastback = 0, status = BS_UNREACHABLE;
+
+    search_reset(s);
+    search_visit(s, r->start, 0, INVALID);
+    s->stampTo[r->stop] = s->gen;
+    s->costFrom[r->stop] = 0;
+    s->cameTo[r->stop] = INVALID;
+    pqueue_push(&s->open, r->start, 0);
+    pqueue_push(&s->back, r->stop, 0);
+    r->near = r->start;
+    if (r->start == r->stop)
+    {
+        best = 0;
+        meet = r->start;
+    }
+    while (!pqueue_empty(&s->open) && !pqueue_empty(&s->back) && lastfore + lastback < best)
+    {
+        if (bounded_spent(r))
+        {
+            status = BS_PARTIAL;
+            break;
+        }
+        if (s->open.size <= s->back.size)
+        { // forwards, a move costs the cell entered
+            u = pqueue_pop(&s->open);
+            lastfore = s->costTo[u];
+            bounded_nearer(r, u);
+            for (i = 1; i < CARDINALS; i++)
+            {
+                v = offsetkey(g, u, y(i), x(i));
+                if (v == INVALID || r->cost[v] == COST_BLOCKED ||
+                    (cost = s->costTo[u] + r->cost[v]) >= search_cost(s, v))
+                    continue;
+                search_visit(s, v, cost, u);
+                pqueue_push(&s->open, v, cost);
+                if (s->stampTo[v] == s->gen && (via = cost + s->costFrom[v]) < best)
+                {
+                    best = via;
+                    meet = v;
+                }
+            }
+        }
+        else
+        { // backwards, a move costs the cell left, towards the stop
+            u = pqueue_pop(&s->back);
+            lastback = s->costFrom[u];
+            for (i = 1; i < CARDINALS; i++)
+            {
+                v = offsetkey(g, u, y(i), x(i));
+                if (v == INVALID || r->cost[v] == COST_BLOCKED)
+                    continue;
+                cost = s->costFrom[u] + r->cost[u];
+                if (s->stampTo[v] == s->gen && cost >= s->costFrom[v])
+                    continue;
+                s->stampTo[v] = s->gen;
+                s->costFrom[v] = cost;
+                s->cameTo[v] = u;
+                pqueue_push(&s->back, v, cost);
+                if ((via = search_cost(s, v)) != MAX_STEPS && via + cost < best)
+                {
+                    best = via + cost;
+                    meet = v;
+                }
+            }
+        }
+    }
+    pqueue_purge(&s->open);
+    pqueue_purge(&s->back);
+    if (status == BS_PARTIAL || meet == INVALID)
+        return status;
+    for (u = meet; (v = s->cameTo[u]) != INVALID; u = v)
+        search_visit(s, v, best - s->costFrom[v], u); // the backward half, as if found forwards
+    return BS_FOUND;
+}
+
+// counts an expansion against the budget, returns whether it has run out.
+// The clock is only read every CLOCK_EVERY expansions
+bool bounded_spent(struct bounded *r)
+{
+    struct timespec now;
+    struct budget *b = r->b;
+
+    if (b->expansions > 0 && b->expanded >= b->expansions)
+        return true;
+    if (b->usec > 0 && b->expanded % CLOCK_EVERY == 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > r->deadline.tv_sec ||
+            (now.tv_sec == r->deadline.tv_sec && now.tv_nsec >= r->deadline.tv_nsec))
+            return true;
+    }
+    b->expanded++;
+    return false;
+}
+
+// keeps the expanded cell nearest the stop, the cheaper of two as near
+void bounded_nearer(struct bounded *r, int key)
+{
+    int d = howfar(r->g, key, r->stop), n = howfar(r->g, r->near, r->stop);
+
+    if (d < n || (d == n && r->s->costTo[key] < r->s->costTo[r->near]))
+        r->near = key;
+    return;
+}
+
+// returns whether the cell is blocked or all of its neighbours are, so no
+// path starts or ends there
+bool walled(const struct grid *g, const uint8_t moveCost[], int key)
+{
+    int i, v;
+
+    if (moveCost[key] == COST_BLOCKED)
+        return true;
+    for (i = 1; i < CARDINALS; i++)
+        if ((v = offsetkey(g, key, y(i), x(i))) != INVALID && moveCost[v] != COST_BLOCKED)
+            return false;
+    return true;
+}
+
+// copies the path the search found to key into p. A weighted search may
+// lower a cell's cost after cells were reached through it, and their costs
+// aren't lowered with it, so the cost is summed along the path as copied
+void bounded_copy(struct bounded *r, int key, struct path *p)
+{
+    int i;
+
+    if (search_path(r->s, r->g, key, p) > p->cap)
+        return; // the cost as recorded, at most that of the path
+    for (i = 1, p->cost = 0; i < p->len; i++)
+        p->cost += r->cost[p->keys[i]];
+    return;
+}
+
+// allocates the backward half of the workspace on its first bidirectional
+// search, FAILURE if out of memory
+bool search_back(struct search *s)
+{
+    if (s->costFrom)
+        return SUCCESS;
+    s->costFrom = malloc(s->size * sizeof(int));
+    s->cameTo = malloc(s->size * sizeof(int));
+    s->stampTo = calloc(s->size, sizeof(uint32_t));
+    if (!s->costFrom || !s->cameTo || !s->stampTo || pqueue_init(&s->back, s->open.type, s->size) == FAILURE)
+    {
+        free(s->costFrom);
+        free(s->cameTo);
+        free(s->stampTo);
+        s->costFrom = s->cameTo = NULL;
+        s->stampTo = NULL;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
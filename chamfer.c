@@ -0,0 +1,171 @@
+/******************************************************************************
+
+Chamfer distance transform
+
+Builds the same costTo / cameFrom maps as create_Djikstra_Map, 8 directions
+and the move cost of the cell entered, without a priority queue. A forward
+sweep runs top left to bottom right taking each cell's cost from its N, NW,
+NE and W neighbours, a backward sweep does the opposite from S, SW, SE and E.
+On uniform ground one pair of sweeps settles the map; where costs vary
+(paths bending around rooms) the pairs repeat until nothing drops, which is
+a Bellman-Ford fixpoint and so the exact distances.
+
+The part of a sweep that reads the row before is the same for every cell of
+the row, so it runs 8 cells per instruction with AVX2; only the run along the
+row is serial. Sweeps work on a row by row copy with a border of
+unreachable cells, so there are no edge tests and any layout is handled.
+Distances are exact, where two neighbours tie cameFrom may pick a different
+one than the flood.
+
+*******************************************************************************/
+
+#include "rl.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define FAR     (1 << 29)   // unreachable during the sweeps, far + far still fits an int
+
+/* #################### FUNCTIONS ############################### */
+bool sweep_rows(int *d, const int *c, int pitch, int width, int from, int to, int dir); // one pass over the rows
+bool sweep_across(int *row, const int *prev, const int *c, int width); // takes row from the row before it
+int min3(int a, int b, int c); // lowest of three
+/* ############################################################## */
+
+// fills costTo with the cost from the nearest source and cameFrom with the
+// neighbour each cell is reached through, like create_Djikstra_Map. Sources
+// on blocked cells are skipped
+void distance_transform(const struct grid *g, const uint8_t moveCost[], const int sources[], int n,
+                        int costTo[], int cameFrom[])
+{
+    int pitch = g->width + 2; // a border column each side
+    int cells = pitch * (g->height + 2); // and a border row above and below
+    int *d = malloc(cells * sizeof(int));
+    int *c = malloc(cells * sizeof(int));
+    int i, row, col, p, best, key;
+    int dy[ALLDIRS], dx[ALLDIRS], delta[ALLDIRS]; // neighbour offsets, and the same as steps in the copy
+    bool changed;
+
+    for (i = 1; i < ALLDIRS; i++)
+    {
+        dy[i] = y(i);
+        dx[i] = x(i);
+        delta[i] = dy[i] * pitch + dx[i];
+    }
+    for (i = 0; i < cells; i++)
+    {
+        d[i] = FAR;
+        c[i] = FAR; // the border can't be entered
+    }
+    for (row = 0; row < g->height; row++)
+        for (col = 0; col < g->width; col++)
+        {
+            key = hash(g, row, col);
+            c[(row + 1) * pitch + col + 1] = moveCost[key] == COST_BLOCKED ? FAR : moveCost[key];
+        }
+    for (i = 0; i < n; i++)
+        if (moveCost[sources[i]] != COST_BLOCKED)
+            d[(gety(g, sources[i]) + 1) * pitch + getx(g, sources[i]) + 1] = 0;
+
+    do
+    { // forward and backward until a pair of sweeps lowers nothing
+        changed = sweep_rows(d, c, pitch, g->width, 1, g->height, 1);
+        changed |= sweep_rows(d, c, pitch, g->width, g->height, 1, -1);
+    } while (changed);
+
+    init(g, costTo, MAX_STEPS); // layout padding, if any, stays unreached
+    init(g, cameFrom, INVALID);
+    for (row = 0; row < g->height; row++)
+        for (col = 0; col < g->width; col++)
+        {
+            p = (row + 1) * pitch + col + 1;
+            key = hash(g, row, col);
+            if (d[p] >= FAR)
+                continue;
+            costTo[key] = d[p];
+            if (d[p] == 0)
+                continue; // a source
+            for (best = 1; d[p + delta[best]] + c[p] != d[p]; best++)
+                ; // first neighbour, in direction order, the cost came through
+            cameFrom[key] = hash(g, row + dy[best], col + dx[best]);
+        }
+    free(d);
+    free(c);
+    return;
+}
+
+// sweeps rows from .. to (border rows are 0 and height + 1) in direction dir:
+// each row first from the row before it, then along itself, left to right
+// going down and right to left going up. Returns whether any cell dropped
+bool sweep_rows(int *d, const int *c, int pitch, int width, int from, int to, int dir)
+{
+    int *row;
+    const int *cost;
+    int r, x, v;
+    bool changed = false;
+
+    for (r = from; r != to + dir; r += dir)
+    {
+        row = d + r * pitch;
+        cost = c + r * pitch;
+        changed |= sweep_across(row, row - dir * pitch, cost, width);
+        if (dir > 0)
+        {
+            for (x = 1; x <= width; x++)
+                if ((v = row[x - 1] + cost[x]) < row[x])
+                {
+                    row[x] = v;
+                    changed = true;
+                }
+        }
+        else
+        {
+            for (x = width; x >= 1; x--)
+                if ((v = row[x + 1] + cost[x]) < row[x])
+                {
+                    row[x] = v;
+                    changed = true;
+                }
+        }
+    }
+    return changed;
+}
+
+// lowers each cell of row to the cheapest of the three cells above (or
+// below) it in prev plus its own cost. Returns whether any cell dropped
+bool sweep_across(int *row, const int *prev, const int *c, int width)
+{
+    int x = 1, v;
+    bool changed = false;
+
+#ifdef __AVX2__
+    __m256i any = _mm256_setzero_si256();
+
+    for (; x + 8 <= width + 1; x += 8)
+    {
+        __m256i m = _mm256_min_epi32(_mm256_loadu_si256((const __m256i *) (prev + x - 1)),
+                                     _mm256_loadu_si256((const __m256i *) (prev + x)));
+        __m256i old = _mm256_loadu_si256((const __m256i *) (row + x));
+        m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i *) (prev + x + 1)));
+        m = _mm256_add_epi32(m, _mm256_loadu_si256((const __m256i *) (c + x)));
+        any = _mm256_or_si256(any, _mm256_cmpgt_epi32(old, m));
+        _mm256_storeu_si256((__m256i *) (row + x), _mm256_min_epi32(old, m));
+    }
+    changed = !_mm256_testz_si256(any, any);
+#endif
+    for (; x <= width; x++)
+    {
+        v = min3(prev[x - 1], prev[x], prev[x + 1]) + c[x];
+        changed |= v < row[x];
+        row[x] = v < row[x] ? v : row[x];
+    }
+    return changed;
+}
+
+// returns the lowest of three ints
+int min3(int a, int b, int c)
+{
+    if (b < a)
+        a = b;
+    return c < a ? c : a;
+}
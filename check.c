@@ -0,0 +1,466 @@
+// self checks, run by make check
+// without arguments compares the distance maps, bounded searches and
+// hierarchical paths with create_Djikstra_Map and astar on random cost
+// planes. Given level packs written by dungen-batch, reads them back through
+// the loader and compares every level with the same level generated again.
+// Exits 1 on the first mismatch
+
+#include <stddef.h>
+#include "rl.h"
+
+#define FOOTER_SIZE		24	// bytes of a pack's footer: index offset, level count, magic
+#define PLANES			24	// random cost planes per layout
+#define QUERIES			12	// searches per plane
+#define CHANGES			20	// cells changed per plane before repairing
+
+bool check_apis(void); // every api against the reference on random planes
+bool check_plane(const struct grid *g, struct rng *r); // one random plane
+bool check_jps(const struct grid *g, struct rng *r); // jps on a rough and an open plane
+void random_plane(const struct grid *g, struct rng *r, uint8_t cost[]); // costs 1 .. 4, a sixth blocked
+void open_plane(const struct grid *g, struct rng *r, uint8_t cost[]); // mostly open ground, for jps to jump over
+int random_open(const struct grid *g, struct rng *r, const uint8_t cost[]); // a cell that isn't blocked
+bool check_flood(const struct grid *g, const uint8_t cost[], const int dist[], const int from[], const int ref[]); // distances match, from steps downhill
+int walk_cost(const struct grid *g, const uint8_t cost[], const struct path *p, int start, int stop); // cost of a path of cardinal steps, INVALID if broken
+int list_cost(const struct grid *g, const uint8_t cost[], const struct node *list, int start, int stop, int dirs); // same for a node list in dirs steps
+bool check_pack(const char *path); // every level of the pack against a fresh one
+bool check_level(const struct packlevel *l, struct dungeon *d, const struct grid *tiles, uint8_t rows[], uint8_t map[]); // one record against its level
+bool check_damaged(const char *path); // damaged copies of the pack must be refused
+bool refused(const char *path, const uint8_t *buf, size_t size); // writes buf to a file that pack_open must refuse
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 2)
+		return check_apis() == FAILURE;
+	for (i = 1; i < argc; i++) // packs written with the default generation options
+		if (check_pack(argv[i]) == FAILURE || check_damaged(argv[i]) == FAILURE)
+			return 1;
+	return 0;
+}
+
+// opens the pack and checks each record against its level generated again,
+// unpacked into both layouts
+bool check_pack(const char *path)
+{
+	struct pack p;
+	const struct packlevel *l;
+	struct dungeon d;
+	struct grid tiles;
+	uint8_t *rows, *map;
+	bool ok = SUCCESS;
+	uint64_t i;
+
+	if (pack_open(&p, path) == FAILURE)
+		return FAILURE;
+	memset(&d, 0, sizeof(d));
+	for (i = 0; ok == SUCCESS && (l = pack_level(&p, i)); i++)
+	{
+		if (d.grid.height != l->height || d.grid.width != l->width)
+		{
+			if (d.map)
+				dungeon_free(&d);
+			if (dungeon_init(&d, l->height, l->width, LAYOUT_ROWS) == FAILURE)
+			{
+				fprintf(stderr, "%s: level %" PRIu64 " is %dx%d\n", path, i, l->width, l->height);
+				pack_close(&p);
+				return FAILURE;
+			}
+			grid_init(&tiles, l->height, l->width, LAYOUT_TILES);
+		}
+		rows = newplane(&d.grid);
+		map = newplane(&tiles);
+		if ((ok = check_level(l, &d, &tiles, rows, map)) == FAILURE)
+			fprintf(stderr, "%s: level %" PRIu64 " doesn't match seed %" PRIu64 " level %" PRIu64 "\n",
+					path, i, l->seed, l->level);
+		free(rows);
+		free(map);
+	}
+	if (ok == SUCCESS && pack_level(&p, p.count))
+	{
+		fprintf(stderr, "%s: a level past the end\n", path);
+		ok = FAILURE;
+	}
+	if (ok == SUCCESS)
+		printf("%s: %" PRIu64 " levels match\n", path, p.count);
+	if (d.map)
+		dungeon_free(&d);
+	pack_close(&p);
+	return ok;
+}
+
+// generates the record's level again and compares its tiles, rooms and
+// points. The tiles are unpacked into rows, a plane of the dungeon's grid,
+// and map, a plane of the tiles grid
+bool check_level(const struct packlevel *l, struct dungeon *d, const struct grid *tiles, uint8_t rows[], uint8_t map[])
+{
+	const struct grid *g = &d->grid;
+	const struct packroom *room = packlevel_rooms(l);
+	const struct packpoint *point = packlevel_points(l);
+	struct room *r;
+	int y, x, i, key;
+
+	generate(d, l->seed, l->level);
+	if (l->nrooms != (uint32_t) d->rooms.n || l->npoints < (uint32_t) d->nlinks ||
+		pack_unpack(l, g, rows) == FAILURE || pack_unpack(l, tiles, map) == FAILURE)
+		return FAILURE;
+	for (r = d->rooms.head; r; r = r->next, room++)
+		if (room->y != gety(g, r->coords) || room->x != getx(g, r->coords) ||
+			room->height != r->height || room->width != r->width)
+			return FAILURE;
+	for (i = 0; i < d->nlinks; i++, point++)
+		if (point->y != gety(g, d->links[i]) || point->x != getx(g, d->links[i]) || point->tile != LINK)
+			return FAILURE;
+	for (y = 0; y < g->height; y++)
+		for (x = 0; x < g->width; x++)
+		{
+			key = hash(g, y, x);
+			if (rows[key] != d->map[key] || map[hash(tiles, y, x)] != d->map[key])
+				return FAILURE;
+			if (d->map[key] == UPSTAIRS || d->map[key] == DOWNSTAIRS)
+			{ // stairs follow the links, row by row
+				if (point->y != y || point->x != x || point->tile != d->map[key])
+					return FAILURE;
+				point++;
+			}
+		}
+	return point == packlevel_points(l) + l->npoints;
+}
+
+// makes damaged copies of the pack next to it, which pack_open must refuse:
+// an index entry far past the end, and a level in an unknown encoding
+bool check_damaged(const char *path)
+{
+	char bad[FILENAME_MAX];
+	uint8_t *buf;
+	uint64_t index, count, at;
+	size_t size;
+	FILE *fp;
+	bool ok;
+
+	if (!(fp = fopen(path, "rb")))
+	{
+		perror(path);
+		return FAILURE;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	buf = malloc(size);
+	if (!buf || size < FOOTER_SIZE || fread(buf, 1, size, fp) != size)
+	{
+		fprintf(stderr, "%s: can't be read\n", path);
+		fclose(fp);
+		free(buf);
+		return FAILURE;
+	}
+	fclose(fp);
+	memcpy(&index, buf + size - FOOTER_SIZE, sizeof(index));
+	memcpy(&count, buf + size - FOOTER_SIZE + sizeof(index), sizeof(count));
+	if (count == 0 || index > size - FOOTER_SIZE - sizeof(at) ||
+		(memcpy(&at, buf + index, sizeof(at)), at > size - sizeof(struct packlevel)))
+	{ // pack_open has taken it, so only when there is no record to damage
+		free(buf);
+		return count == 0 ? SUCCESS : FAILURE;
+	}
+	snprintf(bad, sizeof(bad), "%s.bad", path);
+	memcpy(buf + index, &(uint64_t) { UINT64_MAX - 7 }, sizeof(uint64_t)); // aligned, wraps when a record is added
+	ok = refused(bad, buf, size);
+	memcpy(buf + index, &at, sizeof(at));
+	buf[at + offsetof(struct packlevel, encoding)] = PACK_RLE + 1;
+	ok = ok == SUCCESS ? refused(bad, buf, size) : FAILURE;
+	remove(bad);
+	free(buf);
+	if (ok == SUCCESS)
+		printf("%s: damaged copies refused\n", path);
+	return ok;
+}
+
+// writes size bytes of buf to path and returns whether pack_open refuses it
+bool refused(const char *path, const uint8_t *buf, size_t size)
+{
+	struct pack p;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "wb")) || fwrite(buf, 1, size, fp) != size)
+	{
+		perror(path);
+		if (fp)
+			fclose(fp);
+		return FAILURE;
+	}
+	fclose(fp);
+	if (pack_open(&p, path) == FAILURE)
+		return SUCCESS;
+	fprintf(stderr, "%s: damaged pack accepted\n", path);
+	pack_close(&p);
+	return FAILURE;
+}
+
+// runs check_plane over random planes of a few sizes in both layouts and
+// with both priority queue backends
+bool check_apis(void)
+{
+	struct grid g;
+	struct rng r;
+	int layout, i;
+
+	rng_seed(&r, 1);
+	for (layout = LAYOUT_ROWS; layout <= LAYOUT_TILES; layout++)
+		for (i = 0; i < PLANES; i++)
+		{
+			grid_init(&g, MAP_MIN + rng_below(&r, 60), MAP_MIN + rng_below(&r, 90), layout);
+			set_openset(i % 2 ? PQ_HEAP : PQ_BUCKET);
+			if (check_plane(&g, &r) == FAILURE || check_jps(&g, &r) == FAILURE)
+			{
+				fprintf(stderr, "plane %d of %dx%d %s doesn't match\n", i, g.width, g.height,
+						layout == LAYOUT_ROWS ? "rows" : "tiles");
+				set_openset(PQ_BUCKET);
+				return FAILURE;
+			}
+		}
+	set_openset(PQ_BUCKET);
+	printf("%d random planes: distance maps, bounded searches, jps and hpa paths match\n", PLANES * 2);
+	return SUCCESS;
+}
+
+// on one random plane: distance_transform, dmap_build and dmap_repair
+// against create_Djikstra_Map, then search_bounded in every mode and
+// hpa_path, before and after some cells change, against astar
+bool check_plane(const struct grid *g, struct rng *r)
+{
+	static const int modes[] = { BS_ASTAR, BS_WEIGHTED, BS_BIDIR, BS_ANYTIME };
+	uint8_t *cost = newplane(g);
+	int *ref = newmap(g), *from = newmap(g), *dist = newmap(g);
+	int sources[3], changed[CHANGES], i, j, k, start, stop, best, got, status;
+	struct search s;
+	struct path p = { 0 }, q = { 0 };
+	struct budget b;
+	struct dmap *m = NULL;
+	struct hpa h;
+	bool ok = FAILURE;
+
+	memset(&h, 0, sizeof(h));
+	if (!cost || !ref || !from || !dist || search_init(&s, g) == FAILURE)
+		goto done;
+	p.cap = q.cap = g->size;
+	p.keys = malloc(p.cap * sizeof(int));
+	q.keys = malloc(q.cap * sizeof(int));
+	random_plane(g, r, cost);
+	for (i = 0; i < 3; i++)
+		sources[i] = random_open(g, r, cost);
+	if (!p.keys || !q.keys || hpa_init(&h, g, NULL, sources, 3, 1) == FAILURE)
+		goto done;
+
+	// distance maps
+	create_Djikstra_Map(g, cost, sources, 3, ref, from);
+	distance_transform(g, cost, sources, 3, dist, from);
+	if (check_flood(g, cost, dist, from, ref) == FAILURE)
+		goto done;
+	set_dmap_engine(DM_SWEEP);
+	m = dmap_build(g, cost, sources, 3, 1);
+	set_dmap_engine(DM_FLOOD);
+	if (!m || check_flood(g, cost, m->dist, m->from, ref) == FAILURE)
+		goto done;
+
+	for (k = 0; k < 3; k++)
+	{ // versions 1 .. 3 of the plane
+		for (i = 0; i < QUERIES; i++)
+		{
+			start = random_open(g, r, cost);
+			while ((stop = random_open(g, r, cost)) == start)
+				;
+			best = findpath_keys(&s, g, cost, start, stop, &q) == SUCCESS ? q.cost : INVALID;
+			for (j = 0; j < (int) (sizeof(modes) / sizeof(modes[0])); j++)
+			{ // no budget: exact, or within the bound
+				b.mode = modes[j];
+				b.weight = 100 + rng_below(r, 200);
+				b.expansions = b.usec = 0;
+				status = search_bounded(&s, g, cost, start, stop, &b, &p);
+				got = walk_cost(g, cost, &p, start, stop);
+				if (best == INVALID ? status != BS_UNREACHABLE : status != BS_FOUND || got != p.cost ||
+					got < best || (long) got * 100 > (long) best * b.bound)
+					goto done;
+				b.expansions = 1 + rng_below(r, 50);
+				status = search_bounded(&s, g, cost, start, stop, &b, &p);
+				if (b.expanded > b.expansions || (status == BS_FOUND && walk_cost(g, cost, &p, start, stop) != p.cost))
+					goto done;
+			}
+			got = hpa_path(&h, &s, cost, 1 + k, start, stop, &p) == SUCCESS ? walk_cost(g, cost, &p, start, stop) : INVALID;
+			if ((best == INVALID) != (got == INVALID) || (got != INVALID && (got != p.cost || got < best)))
+				goto done;
+		}
+
+		// change some cells, then repair rather than reflood
+		for (i = 0; i < CHANGES; i++)
+		{
+			changed[i] = random_open(g, r, cost);
+			cost[changed[i]] = rng_below(r, 3) ? 1 + rng_below(r, 4) : COST_BLOCKED;
+		}
+		if (dmap_repair(m, cost, changed, CHANGES, 2 + k) == FAILURE)
+			goto done;
+		if (k == 0) // the next change bumps the version unannounced
+			hpa_invalidate(&h, changed, CHANGES, 2 + k);
+		create_Djikstra_Map(g, cost, sources, 3, ref, from);
+		if (check_flood(g, cost, m->dist, m->from, ref) == FAILURE)
+			goto done;
+	}
+	ok = SUCCESS;
+done:
+	dmap_release(m);
+	hpa_free(&h);
+	if (s.size)
+		search_free(&s);
+	free(p.keys);
+	free(q.keys);
+	free(cost);
+	free(ref);
+	free(from);
+	free(dist);
+	return ok;
+}
+
+// jps over a random plane and a mostly open one, where it jumps: in 4
+// directions against astar, in 8 against create_Djikstra_Map from the start
+bool check_jps(const struct grid *g, struct rng *r)
+{
+	uint8_t *cost = newplane(g);
+	int *dist = newmap(g), *from = newmap(g);
+	int i, k, start, stop, best, got;
+	struct search s;
+	struct node *list;
+	bool ok = FAILURE;
+
+	if (!cost || !dist || !from || search_init(&s, g) == FAILURE)
+		goto done;
+	for (k = 0; k < 2; k++)
+	{
+		if (k == 0)
+			random_plane(g, r, cost);
+		else
+			open_plane(g, r, cost);
+		for (i = 0; i < QUERIES; i++)
+		{
+			start = random_open(g, r, cost);
+			while ((stop = random_open(g, r, cost)) == start)
+				;
+			best = astar_search(&s, g, cost, start, stop) ? search_cost(&s, stop) : INVALID;
+			list = jps(&s, g, cost, start, stop, CARDINALS);
+			got = list_cost(g, cost, list, start, stop, CARDINALS);
+			nodelist_purge(&s.nodes, &list);
+			if (got != best)
+				goto done;
+			create_Djikstra_Map(g, cost, &start, 1, dist, from);
+			best = dist[stop] == MAX_STEPS ? INVALID : dist[stop];
+			list = jps(&s, g, cost, start, stop, ALLDIRS);
+			got = list_cost(g, cost, list, start, stop, ALLDIRS);
+			nodelist_purge(&s.nodes, &list);
+			if (got != best)
+				goto done;
+		}
+	}
+	ok = SUCCESS;
+done:
+	if (s.size)
+		search_free(&s);
+	free(cost);
+	free(dist);
+	free(from);
+	return ok;
+}
+
+// fills the plane with costs 1 .. 4, a sixth of the cells blocked
+void random_plane(const struct grid *g, struct rng *r, uint8_t cost[])
+{
+	int y, x;
+
+	for (y = 0; y < g->height; y++)
+		for (x = 0; x < g->width; x++)
+			cost[hash(g, y, x)] = rng_below(r, 6) ? 1 + rng_below(r, 4) : COST_BLOCKED;
+	return;
+}
+
+// fills the plane with open ground, one cell in sixteen blocked and one in
+// sixteen costing 2 .. 4
+void open_plane(const struct grid *g, struct rng *r, uint8_t cost[])
+{
+	int y, x, roll;
+
+	for (y = 0; y < g->height; y++)
+		for (x = 0; x < g->width; x++)
+		{
+			roll = rng_below(r, 16);
+			cost[hash(g, y, x)] = roll == 0 ? COST_BLOCKED : roll == 1 ? 2 + rng_below(r, 3) : 1;
+		}
+	return;
+}
+
+// returns a random cell of the plane that isn't blocked
+int random_open(const struct grid *g, struct rng *r, const uint8_t cost[])
+{
+	int key;
+
+	do
+		key = hash(g, rng_below(r, g->height), rng_below(r, g->width));
+	while (cost[key] == COST_BLOCKED);
+	return key;
+}
+
+// returns whether dist holds the reference distances, and each reachable
+// cell's from is a neighbour it is reached through at its cost. Where two
+// neighbours tie either will do
+bool check_flood(const struct grid *g, const uint8_t cost[], const int dist[], const int from[], const int ref[])
+{
+	int y, x, key, f;
+
+	for (y = 0; y < g->height; y++)
+		for (x = 0; x < g->width; x++)
+		{
+			key = hash(g, y, x);
+			if (dist[key] != ref[key])
+				return FAILURE;
+			if ((f = from[key]) == INVALID)
+				continue; // a source, or unreachable
+			if (abs(gety(g, f) - y) > 1 || abs(getx(g, f) - x) > 1 || dist[key] != dist[f] + cost[key])
+				return FAILURE;
+		}
+	return SUCCESS;
+}
+
+// returns the move cost of the path in p, INVALID unless it runs from start
+// to stop in cardinal steps without entering a blocked cell
+int walk_cost(const struct grid *g, const uint8_t cost[], const struct path *p, int start, int stop)
+{
+	int i, sum = 0;
+
+	if (p->len < 1 || p->len > p->cap || p->keys[0] != start || p->keys[p->len - 1] != stop)
+		return INVALID;
+	for (i = 1; i < p->len; i++)
+	{
+		if (howfar(g, p->keys[i - 1], p->keys[i]) != 1 || cost[p->keys[i]] == COST_BLOCKED)
+			return INVALID;
+		sum += cost[p->keys[i]];
+	}
+	return sum;
+}
+
+// returns the move cost of the path in list, INVALID unless it runs from
+// start to stop in steps of the dirs neighbourhood without entering a
+// blocked cell
+int list_cost(const struct grid *g, const uint8_t cost[], const struct node *list, int start, int stop, int dirs)
+{
+	int sum = 0, prev, dy, dx;
+
+	if (!list || list->key != start)
+		return INVALID;
+	for (prev = start, list = list->next; list; prev = list->key, list = list->next)
+	{
+		dy = abs(gety(g, list->key) - gety(g, prev));
+		dx = abs(getx(g, list->key) - getx(g, prev));
+		if (dy > 1 || dx > 1 || dy + dx == 0 || (dirs == CARDINALS && dy + dx != 1) ||
+			cost[list->key] == COST_BLOCKED)
+			return INVALID;
+		sum += cost[list->key];
+	}
+	return prev == stop ? sum : INVALID;
+}
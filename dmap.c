@@ -0,0 +1,289 @@
+/******************************************************************************
+
+Distance maps
+
+A distance map holds the cost of the cheapest path from every cell to the
+nearest of a set of sources (stairs, the player, ...), plus the next cell
+along that path. Any number of agents walk towards the sources by following
+dmap_step() downhill, so one flood replaces an astar call per agent.
+
+Maps are reference counted. A cache keeps recently built maps and hands the
+same map out again while the cost plane version and the source set match;
+a map built for an older version is dropped on the next lookup. A cache
+belongs to one thread.
+
+When a few cells change cost (a door opens, a corridor is carved) a map is
+repaired in place rather than reflooded. The repair is Lifelong Planning A*
+without a heuristic: rhs[] holds the best cost each cell's neighbours offer,
+cells where it disagrees with dist[] are queued, and only those and the cells
+their changes reach are visited. Distances come out the same as a fresh
+flood; where two neighbours tie, from[] may pick the other one.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+/* #################### FUNCTIONS ############################### */
+int dmap_sources(const struct grid *g, const int sources[], int n, int out[]); // sorted valid sources without repeats
+bool dmap_matches(const struct dmap *m, uint64_t version, const int sources[], int n); // built for this version and source set?
+int intcmp(const void *a, const void *b); // qsort order for ints
+bool dmap_issource(const struct dmap *m, int key); // is key one of the map's sources?
+void dmap_update(struct dmap *m, const uint8_t moveCost[], int key); // recomputes rhs of key and queues it if inconsistent
+/* ############################################################## */
+
+static int engine = DM_FLOOD; // how dmap_build floods the map
+
+// select how dmap_build floods the map: DM_FLOOD, the priority queue flood
+// of create_Djikstra_Map, or DM_SWEEP, the raster sweeps of
+// distance_transform. Both give the same distances
+void set_dmap_engine(int type)
+{
+    engine = type;
+    return;
+}
+
+// floods the cost plane from the n sources and returns a new distance map
+// owned by the caller, NULL if out of memory. Sources off the map are
+// dropped, sources on blocked cells don't flood. version is recorded for
+// the cache
+struct dmap *dmap_build(const struct grid *g, const uint8_t moveCost[], const int sources[], int n, uint64_t version)
+{
+    struct dmap *m = calloc(1, sizeof(struct dmap));
+
+    if (!m)
+        return NULL;
+    m->grid = *g;
+    m->dist = malloc(g->size * sizeof(int));
+    m->from = malloc(g->size * sizeof(int));
+    m->sources = malloc((n ? n : 1) * sizeof(int));
+    if (!m->dist || !m->from || !m->sources)
+    {
+        m->refs = 1;
+        dmap_release(m);
+        return NULL;
+    }
+    m->nsources = dmap_sources(g, sources, n, m->sources);
+    m->version = version;
+    m->refs = 1;
+    if (engine == DM_SWEEP)
+        distance_transform(g, moveCost, m->sources, m->nsources, m->dist, m->from);
+    else
+        create_Djikstra_Map(g, moveCost, m->sources, m->nsources, m->dist, m->from);
+    return m;
+}
+
+// adds an owner to the map and returns it
+struct dmap *dmap_retain(struct dmap *m)
+{
+    m->refs++;
+    return m;
+}
+
+// drops an owner, the last one frees the map
+void dmap_release(struct dmap *m)
+{
+    if (!m || --m->refs > 0)
+        return;
+    free(m->dist);
+    free(m->from);
+    free(m->sources);
+    free(m->rhs);
+    pqueue_free(&m->open);
+    free(m);
+    return;
+}
+
+// returns the next cell from key towards the nearest source, INVALID at a
+// source or where no source can be reached
+int dmap_step(const struct dmap *m, int key)
+{
+    return m->from[key];
+}
+
+// updates the map after the move cost of the cells in changed[] changed.
+// The map must match moveCost as it was before the change, it is stamped
+// with version afterwards. Every owner of the map sees the repair.
+// FAILURE if out of memory, the map is left as it was
+bool dmap_repair(struct dmap *m, const uint8_t moveCost[], const int changed[], int n, uint64_t version)
+{
+    const struct grid *g = &m->grid;
+    int i, key, child, old;
+
+    if (!m->rhs)
+    { // first repair: every cell is consistent, rhs is dist
+        if (!(m->rhs = malloc(g->size * sizeof(int))))
+            return FAILURE;
+        if (pqueue_init(&m->open, get_openset(), g->size) == FAILURE)
+        {
+            free(m->rhs);
+            m->rhs = NULL;
+            return FAILURE;
+        }
+        memcpy(m->rhs, m->dist, g->size * sizeof(int));
+    }
+    for (i = 0; i < n; i++)
+        if (isValid(g, changed[i]))
+            dmap_update(m, moveCost, changed[i]);
+    while (!pqueue_empty(&m->open))
+    {
+        key = pqueue_pop(&m->open);
+        old = m->dist[key];
+        if (old > m->rhs[key])
+        { // overconsistent: a cheaper way in, settle it and offer it on
+            m->dist[key] = m->rhs[key];
+            for (i = 1; i < ALLDIRS; i++)
+            {
+                child = offsetkey(g, key, y(i), x(i));
+                if (child != INVALID && moveCost[child] != COST_BLOCKED &&
+                    m->dist[key] + moveCost[child] < m->rhs[child])
+                    dmap_update(m, moveCost, child);
+            }
+        }
+        else
+        { // underconsistent: its way in got dearer, unsettle it and whoever came through it
+            m->dist[key] = MAX_STEPS;
+            dmap_update(m, moveCost, key);
+            for (i = 1; i < ALLDIRS; i++)
+            {
+                child = offsetkey(g, key, y(i), x(i));
+                if (child != INVALID && m->from[child] == key)
+                    dmap_update(m, moveCost, child);
+            }
+        }
+    }
+    m->version = version;
+    return SUCCESS;
+}
+
+// starts an empty cache that keeps up to cap maps
+bool dmap_cache_init(struct dmapcache *c, int cap)
+{
+    memset(c, 0, sizeof(*c));
+    c->cap = cap > 0 ? cap : 1;
+    c->maps = malloc(c->cap * sizeof(struct dmap *));
+    return c->maps ? SUCCESS : FAILURE;
+}
+
+// releases every cached map. Maps still held by callers stay alive
+void dmap_cache_free(struct dmapcache *c)
+{
+    int i;
+
+    for (i = 0; i < c->n; i++)
+        dmap_release(c->maps[i]);
+    free(c->maps);
+    memset(c, 0, sizeof(*c));
+    return;
+}
+
+// returns the distance map of the n sources over version of the cost plane,
+// built on a miss and cached. The caller owns a reference and releases it.
+// Maps of other versions are dropped, the least recently used map goes when
+// the cache is full
+struct dmap *dmap_cache_get(struct dmapcache *c, const struct grid *g, const uint8_t moveCost[],
+                            uint64_t version, const int sources[], int n)
+{
+    struct dmap *m = NULL;
+    int *key = malloc((n ? n : 1) * sizeof(int));
+    int i, j, nkey;
+
+    if (!key)
+        return NULL;
+    nkey = dmap_sources(g, sources, n, key);
+    for (i = j = 0; i < c->n; i++)
+    { // sweep out stale maps, keeping the order of the rest
+        if (c->maps[i]->version != version)
+            dmap_release(c->maps[i]);
+        else
+            c->maps[j++] = c->maps[i];
+    }
+    c->n = j;
+    for (i = 0; i < c->n && !m; i++)
+        if (dmap_matches(c->maps[i], version, key, nkey))
+            m = c->maps[i];
+    if (m)
+    { // move to the front, the most recently used
+        memmove(&c->maps[1], &c->maps[0], (i - 1) * sizeof(struct dmap *));
+        c->hits++;
+    }
+    else
+    {
+        if (!(m = dmap_build(g, moveCost, key, nkey, version)))
+        {
+            free(key);
+            return NULL;
+        }
+        if (c->n == c->cap)
+            dmap_release(c->maps[--c->n]); // evict the least recently used
+        memmove(&c->maps[1], &c->maps[0], c->n++ * sizeof(struct dmap *));
+        c->misses++;
+    }
+    c->maps[0] = m;
+    free(key);
+    return dmap_retain(m);
+}
+
+// writes the valid sources to out sorted and without repeats, returns how many
+int dmap_sources(const struct grid *g, const int sources[], int n, int out[])
+{
+    int i, k = 0;
+
+    for (i = 0; i < n; i++)
+        if (isValid(g, sources[i]))
+            out[k++] = sources[i];
+    qsort(out, k, sizeof(int), intcmp);
+    for (i = n = 0; i < k; i++)
+        if (n == 0 || out[i] != out[n - 1])
+            out[n++] = out[i];
+    return n;
+}
+
+// returns whether the map was built for this version and normalised source set
+bool dmap_matches(const struct dmap *m, uint64_t version, const int sources[], int n)
+{
+    return m->version == version && m->nsources == n &&
+           memcmp(m->sources, sources, n * sizeof(int)) == 0;
+}
+
+// returns whether key is one of the map's sources
+bool dmap_issource(const struct dmap *m, int key)
+{
+    return bsearch(&key, m->sources, m->nsources, sizeof(int), intcmp) != NULL;
+}
+
+// recomputes rhs of key from its neighbours' dist, with from[] pointing at
+// the cheapest, and queues key at min(dist, rhs) if the two disagree
+void dmap_update(struct dmap *m, const uint8_t moveCost[], int key)
+{
+    const struct grid *g = &m->grid;
+    int i, n, best = MAX_STEPS, from = INVALID;
+
+    if (moveCost[key] == COST_BLOCKED)
+        ; // unreachable, a blocked source included
+    else if (dmap_issource(m, key))
+        best = 0;
+    else
+        for (i = 1; i < ALLDIRS; i++)
+        {
+            n = offsetkey(g, key, y(i), x(i));
+            if (n != INVALID && m->dist[n] != MAX_STEPS && m->dist[n] + moveCost[key] < best)
+            {
+                best = m->dist[n] + moveCost[key];
+                from = n;
+            }
+        }
+    m->rhs[key] = best;
+    m->from[key] = from;
+    pqueue_remove(&m->open, key);
+    if (m->dist[key] != best)
+        pqueue_push(&m->open, key, m->dist[key] < best ? m->dist[key] : best);
+    return;
+}
+
+// qsort order for ints
+int intcmp(const void *a, const void *b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,416 @@
+/******************************************************************************
+
+Hierarchical pathfinding (HPA*)
+
+For long trips across a large map. The map is cut into CHUNK x CHUNK
+chunks and a path is planned over a small abstract graph first, then
+refined a chunk at a time, so a query touches the chunks along the way
+instead of every cell between start and stop.
+
+The abstract nodes of a chunk are its portals, cells on its edges paired
+with the cell across, one per run of edge where the move costs on both sides
+stay the same (open stone, a wall, a corridor crossing the edge), and
+waypoints from the generator: the centre of each room and the links the
+corridors start from. Each chunk caches the cost between every pair of its
+nodes along paths inside it. When tiles change, hpa_invalidate marks their
+chunk dirty (and the neighbour across, for a cell on an edge) and its nodes
+and costs are worked out again the next time a query reaches it. A query
+over a version of the cost plane the layer hasn't been told about, tiles
+changed without hpa_invalidate, starts every chunk again.
+
+Moves are the 4 directions astar uses, costing the cell entered. Paths are
+close to the cheapest, not always the cheapest: a portal stands for its
+whole run of edge.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+#define CHUNK       16      // cells per side of a chunk
+#define NODES_MIN   16      // nodes a chunk has room for at first
+
+// one chunk's abstract nodes and the costs between them
+struct chunk {
+    int *key;               // portals on the chunk's edges, then waypoints
+    int *twin;              // the cell across the edge from each portal, INVALID for waypoints
+    int n, cap;
+    int *cost;              // n x n, cheapest path inside the chunk from node i to node j
+    int costcap;
+    int *way, nway, waycap; // waypoints in the chunk
+    bool dirty;             // tiles changed since the nodes and costs were worked out
+};
+
+/* #################### FUNCTIONS ############################### */
+int chunkof(const struct hpa *h, int key); // chunk a cell is in
+void chunk_build(struct hpa *h, const uint8_t moveCost[], int c); // works out a chunk's nodes and costs
+void chunk_edge(struct hpa *h, const uint8_t moveCost[], int c, int y, int x, int dy, int dx, int ay, int ax, int len); // portals along one edge
+void chunk_add(struct chunk *k, int key, int twin); // adds a node
+void chunk_flood(struct hpa *h, const uint8_t moveCost[], int c, int key, bool back, int stop); // cheapest paths inside a chunk
+int chunk_cell(const struct hpa *h, int c, int key); // index of a cell in the local search buffers
+void hpa_relax(struct search *s, int stop, const struct grid *g, int from, int key, int cost); // offers key a cost through from
+void hpa_waypoint(struct hpa *h, int key); // adds a waypoint to its chunk
+int *hpa_grow(int *buf, int *cap, int n); // makes buf hold at least n ints
+/* ############################################################## */
+
+// starts the abstract layer for version of a map of grid g: chunks, and a
+// waypoint at the centre of every room in the list and at each of the n
+// links. Nothing is worked out until a query needs it. FAILURE if out of memory
+bool hpa_init(struct hpa *h, const struct grid *g, const struct room *rooms, const int links[], int n, uint64_t version)
+{
+    const struct room *r;
+    int i;
+
+    memset(h, 0, sizeof(*h));
+    h->grid = *g;
+    h->version = version;
+    h->rows = (g->height + CHUNK - 1) / CHUNK;
+    h->cols = (g->width + CHUNK - 1) / CHUNK;
+    h->chunks = calloc(h->rows * h->cols, sizeof(struct chunk));
+    h->dist = malloc(CHUNK * CHUNK * sizeof(int));
+    h->from = malloc(CHUNK * CHUNK * sizeof(int));
+    if (!h->chunks || !h->dist || !h->from || pqueue_init(&h->open, get_openset(), CHUNK * CHUNK) == FAILURE)
+    {
+        hpa_free(h);
+        return FAILURE;
+    }
+    for (i = 0; i < h->rows * h->cols; i++)
+        h->chunks[i].dirty = true;
+    for (r = rooms; r; r = r->next)
+        hpa_waypoint(h, offsetkey(g, r->coords, r->height / 2, r->width / 2));
+    for (i = 0; i < n; i++)
+        hpa_waypoint(h, links[i]);
+    return SUCCESS;
+}
+
+// frees the abstract layer
+void hpa_free(struct hpa *h)
+{
+    int i;
+
+    for (i = 0; h->chunks && i < h->rows * h->cols; i++)
+    {
+        free(h->chunks[i].key);
+        free(h->chunks[i].twin);
+        free(h->chunks[i].cost);
+        free(h->chunks[i].way);
+    }
+    free(h->chunks);
+    free(h->dist);
+    free(h->from);
+    free(h->startcost);
+    free(h->stopcost);
+    free(h->chain);
+    pqueue_free(&h->open);
+    memset(h, 0, sizeof(*h));
+    return;
+}
+
+// the move cost of the n cells in changed is now that of version: their
+// chunks, and the chunk across for cells on an edge, are worked out again
+// when next needed
+void hpa_invalidate(struct hpa *h, const int changed[], int n, uint64_t version)
+{
+    const struct grid *g = &h->grid;
+    int i, y, x, cy, cx;
+
+    h->version = version;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!isValid(g, changed[i]))
+            continue;
+        y = gety(g, changed[i]);
+        x = getx(g, changed[i]);
+        cy = y / CHUNK;
+        cx = x / CHUNK;
+        h->chunks[cy * h->cols + cx].dirty = true;
+        if (y % CHUNK == 0 && cy > 0)
+            h->chunks[(cy - 1) * h->cols + cx].dirty = true;
+        if (y % CHUNK == CHUNK - 1 && cy + 1 < h->rows)
+            h->chunks[(cy + 1) * h->cols + cx].dirty = true;
+        if (x % CHUNK == 0 && cx > 0)
+            h->chunks[cy * h->cols + cx - 1].dirty = true;
+        if (x % CHUNK == CHUNK - 1 && cx + 1 < h->cols)
+            h->chunks[cy * h->cols + cx + 1].dirty = true;
+    }
+    return;
+}
+
+// finds a path from start to stop over version of the cost plane, planned
+// on the abstract graph with the workspace s, and refines it into p like findpath_keys: SUCCESS if a path
+// was found and fits, FAILURE with p->len 0 if there is none, or with
+// p->len past p->cap if the buffer is short, and the query can be run again
+// with a bigger one
+bool hpa_path(struct hpa *h, struct search *s, const uint8_t moveCost[], uint64_t version,
+              int start, int stop, struct path *p)
+{
+    const struct grid *g = &h->grid;
+    struct chunk *k;
+    int sc = chunkof(h, start), tc = chunkof(h, stop);
+    int u, c, i, j, cost, n, a, b, at, cell, direct = MAX_STEPS;
+
+    p->len = p->cost = 0;
+    if (version != h->version)
+    { // changed behind the layer's back, nothing cached can be trusted
+        for (i = 0; i < h->rows * h->cols; i++)
+            h->chunks[i].dirty = true;
+        h->version = version;
+    }
+    if (moveCost[start] == COST_BLOCKED || moveCost[stop] == COST_BLOCKED)
+        return FAILURE;
+    if (h->chunks[sc].dirty)
+        chunk_build(h, moveCost, sc);
+    if (h->chunks[tc].dirty)
+        chunk_build(h, moveCost, tc);
+
+    // the start and stop join the graph through their own chunks
+    k = &h->chunks[sc];
+    chunk_flood(h, moveCost, sc, start, false, INVALID);
+    h->startcost = hpa_grow(h->startcost, &h->startcap, k->n);
+    for (i = 0; i < k->n; i++)
+        h->startcost[i] = h->dist[chunk_cell(h, sc, k->key[i])];
+    if (sc == tc)
+        direct = h->dist[chunk_cell(h, sc, stop)];
+    k = &h->chunks[tc];
+    chunk_flood(h, moveCost, tc, stop, true, INVALID);
+    h->stopcost = hpa_grow(h->stopcost, &h->stopcap, k->n);
+    for (i = 0; i < k->n; i++)
+        h->stopcost[i] = h->dist[chunk_cell(h, tc, k->key[i])];
+
+    search_reset(s);
+    search_visit(s, start, 0, INVALID);
+    pqueue_push(&s->open, start, howfar(g, start, stop));
+    while ((u = pqueue_pop(&s->open)) != INVALID && u != stop)
+    {
+        cost = s->costTo[u];
+        if (u == start)
+        {
+            for (i = 0; i < h->chunks[sc].n; i++)
+                if (h->startcost[i] != MAX_STEPS)
+                    hpa_relax(s, stop, g, u, h->chunks[sc].key[i], h->startcost[i]);
+            if (direct != MAX_STEPS)
+                hpa_relax(s, stop, g, u, stop, direct);
+        }
+        if (h->chunks[c = chunkof(h, u)].dirty)
+            chunk_build(h, moveCost, c); // first visit since its tiles changed
+        k = &h->chunks[c];
+        for (i = 0; i < k->n; i++)
+        {
+            if (k->key[i] != u)
+                continue;
+            for (j = 0; j < k->n; j++)
+                if (j != i && k->cost[i * k->n + j] != MAX_STEPS)
+                    hpa_relax(s, stop, g, u, k->key[j], cost + k->cost[i * k->n + j]);
+            if (k->twin[i] != INVALID)
+                hpa_relax(s, stop, g, u, k->twin[i], cost + moveCost[k->twin[i]]);
+            if (c == tc && h->stopcost[i] != MAX_STEPS)
+                hpa_relax(s, stop, g, u, stop, cost + h->stopcost[i]);
+        }
+    }
+    pqueue_purge(&s->open);
+    if (u != stop)
+        return FAILURE;
+
+    // the abstract path, start to stop
+    for (n = 0, u = stop; u != INVALID; u = s->cameFrom[u])
+        n++;
+    h->chain = hpa_grow(h->chain, &h->chaincap, n);
+    for (i = n, u = stop; u != INVALID; u = s->cameFrom[u])
+        h->chain[--i] = u;
+
+    // refined one hop at a time, a step across an edge or a path inside a chunk
+    p->cost = s->costTo[stop];
+    if (p->cap > 0)
+        p->keys[0] = start;
+    p->len = 1;
+    for (i = 1; i < n; i++)
+    {
+        a = h->chain[i - 1];
+        b = h->chain[i];
+        if (howfar(g, a, b) == 1)
+        {
+            if (p->len < p->cap)
+                p->keys[p->len] = b;
+            p->len++;
+            continue;
+        }
+        c = chunkof(h, a);
+        chunk_flood(h, moveCost, c, a, false, b);
+        for (j = 0, cell = b; cell != a; cell = h->from[chunk_cell(h, c, cell)])
+            j++; // steps of the hop
+        for (at = p->len + j, cell = b; cell != a; cell = h->from[chunk_cell(h, c, cell)])
+            if (--at < p->cap)
+                p->keys[at] = cell;
+        p->len += j;
+    }
+    return p->len <= p->cap;
+}
+
+// returns the chunk a cell is in
+int chunkof(const struct hpa *h, int key)
+{
+    return gety(&h->grid, key) / CHUNK * h->cols + getx(&h->grid, key) / CHUNK;
+}
+
+// works out chunk c's nodes, the portals on each edge with a chunk beyond
+// it and its open waypoints, and the cost between every pair of them
+void chunk_build(struct hpa *h, const uint8_t moveCost[], int c)
+{
+    const struct grid *g = &h->grid;
+    struct chunk *k = &h->chunks[c];
+    int y0 = c / h->cols * CHUNK, x0 = c % h->cols * CHUNK;
+    int height = g->height - y0 < CHUNK ? g->height - y0 : CHUNK;
+    int width = g->width - x0 < CHUNK ? g->width - x0 : CHUNK;
+    int i, j;
+
+    k->n = 0;
+    if (y0 > 0) // north edge, cells along it run east
+        chunk_edge(h, moveCost, c, y0, x0, 0, 1, -1, 0, width);
+    if (y0 + height < g->height) // south
+        chunk_edge(h, moveCost, c, y0 + height - 1, x0, 0, 1, 1, 0, width);
+    if (x0 > 0) // west, cells along it run south
+        chunk_edge(h, moveCost, c, y0, x0, 1, 0, 0, -1, height);
+    if (x0 + width < g->width) // east
+        chunk_edge(h, moveCost, c, y0, x0 + width - 1, 1, 0, 0, 1, height);
+    for (i = 0; i < k->nway; i++)
+        if (moveCost[k->way[i]] != COST_BLOCKED)
+            chunk_add(k, k->way[i], INVALID);
+
+    if (k->n * k->n > k->costcap)
+    {
+        k->costcap = k->n * k->n;
+        k->cost = realloc(k->cost, k->costcap * sizeof(int));
+    }
+    for (i = 0; i < k->n; i++)
+    {
+        chunk_flood(h, moveCost, c, k->key[i], false, INVALID);
+        for (j = 0; j < k->n; j++)
+            k->cost[i * k->n + j] = h->dist[chunk_cell(h, c, k->key[j])];
+    }
+    k->dirty = false;
+    h->builds++;
+    return;
+}
+
+// adds chunk c's portals along one edge: len cells from y, x stepping dy,
+// dx, each with the cell ay, ax across from it. A portal sits in the middle
+// of each run of cells that are open on both sides at the same pair of move
+// costs. The chunk across sees the same runs, so both agree on the portals
+void chunk_edge(struct hpa *h, const uint8_t moveCost[], int c, int y, int x, int dy, int dx, int ay, int ax, int len)
+{
+    const struct grid *g = &h->grid;
+    int i, first = INVALID, in, out, pin = 0, pout = 0;
+
+    for (i = 0; i <= len; i++)
+    {
+        in = i < len ? moveCost[hash(g, y + i * dy, x + i * dx)] : COST_BLOCKED;
+        out = i < len ? moveCost[hash(g, y + i * dy + ay, x + i * dx + ax)] : COST_BLOCKED;
+        if (first != INVALID && (in != pin || out != pout))
+        { // the run before ends here
+            first += (i - 1 - first) / 2;
+            chunk_add(&h->chunks[c], hash(g, y + first * dy, x + first * dx),
+                      hash(g, y + first * dy + ay, x + first * dx + ax));
+            first = INVALID;
+        }
+        if (first == INVALID && in != COST_BLOCKED && out != COST_BLOCKED)
+            first = i;
+        pin = in;
+        pout = out;
+    }
+    return;
+}
+
+// adds a node to the chunk
+void chunk_add(struct chunk *k, int key, int twin)
+{
+    if (k->n == k->cap)
+    {
+        k->cap = k->cap ? k->cap * 2 : NODES_MIN;
+        k->key = realloc(k->key, k->cap * sizeof(int));
+        k->twin = realloc(k->twin, k->cap * sizeof(int));
+    }
+    k->key[k->n] = key;
+    k->twin[k->n++] = twin;
+    return;
+}
+
+// fills h->dist with the cheapest paths inside chunk c from key, or with
+// back, to key, and h->from with the cell each was reached from. Stops once
+// stop is settled, if it isn't INVALID
+void chunk_flood(struct hpa *h, const uint8_t moveCost[], int c, int key, bool back, int stop)
+{
+    const struct grid *g = &h->grid;
+    int y0 = c / h->cols * CHUNK, x0 = c % h->cols * CHUNK;
+    int i, u, v, uy, ux, vy, vx, cost;
+
+    for (i = 0; i < CHUNK * CHUNK; i++)
+        h->dist[i] = MAX_STEPS;
+    h->dist[chunk_cell(h, c, key)] = 0;
+    h->from[chunk_cell(h, c, key)] = INVALID;
+    pqueue_push(&h->open, chunk_cell(h, c, key), 0);
+    while ((u = pqueue_pop(&h->open)) != INVALID)
+    {
+        uy = y0 + u / CHUNK;
+        ux = x0 + u % CHUNK;
+        if (hash(g, uy, ux) == stop)
+            break;
+        for (i = 1; i < CARDINALS; i++)
+        {
+            vy = uy + y(i);
+            vx = ux + x(i);
+            if (vy < y0 || vy >= y0 + CHUNK || vx < x0 || vx >= x0 + CHUNK ||
+                vy >= g->height || vx >= g->width || moveCost[hash(g, vy, vx)] == COST_BLOCKED)
+                continue; // off the chunk
+            v = (vy - y0) * CHUNK + vx - x0;
+            // forwards a move costs the cell entered, backwards the cell left
+            cost = h->dist[u] + moveCost[back ? hash(g, uy, ux) : hash(g, vy, vx)];
+            if (cost < h->dist[v])
+            {
+                h->dist[v] = cost;
+                h->from[v] = hash(g, uy, ux);
+                pqueue_push(&h->open, v, cost);
+            }
+        }
+    }
+    pqueue_purge(&h->open);
+    return;
+}
+
+// returns the index of a cell of chunk c in the local search buffers
+int chunk_cell(const struct hpa *h, int c, int key)
+{
+    return (gety(&h->grid, key) - c / h->cols * CHUNK) * CHUNK + getx(&h->grid, key) - c % h->cols * CHUNK;
+}
+
+// offers key the cost through from, queued by the cost plus the manhattan
+// distance left, a move costing at least 1
+void hpa_relax(struct search *s, int stop, const struct grid *g, int from, int key, int cost)
+{
+    if (cost >= search_cost(s, key))
+        return;
+    search_visit(s, key, cost, from);
+    pqueue_push(&s->open, key, cost + howfar(g, key, stop));
+    return;
+}
+
+// adds a waypoint to the chunk it is in
+void hpa_waypoint(struct hpa *h, int key)
+{
+    struct chunk *k;
+
+    if (!isValid(&h->grid, key))
+        return;
+    k = &h->chunks[chunkof(h, key)];
+    k->way = hpa_grow(k->way, &k->waycap, k->nway + 1);
+    k->way[k->nway++] = key;
+    return;
+}
+
+// returns buf grown to hold at least n ints, cap updated
+int *hpa_grow(int *buf, int *cap, int n)
+{
+    if (n <= *cap)
+        return buf;
+    *cap = n > *cap * 2 ? n : *cap * 2;
+    return realloc(buf, *cap * sizeof(int));
+}
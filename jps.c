@@ -0,0 +1,286 @@
+/******************************************************************************
+
+Jump point search
+
+A* that skips over open ground. Between rooms most cells are STONE, which all
+cost the same to move through, and A* would push every one of them. Here a
+search only stops at jump points: the goal, cells where the path may need to
+turn, and any cell touching terrain of another cost. Around those it falls
+back to regular A* expansion, so BORDER and SPACER cells and the start and
+stop overrides are costed exactly as astar does.
+
+Works on the 4 direction (CARDINALS) and 8 direction (ALLDIRS) neighbourhoods.
+With 4 directions the canonical path is vertical first, so a vertical jump
+looks along each row it passes for something to turn towards. Horizontal
+runs test 64 cells at a time on a bitboard of the cells that aren't open
+ground, filled a row at a time as the search reaches it.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+#define UNIFORM     1   // move cost of open ground, what jumps run over
+
+// state of one search
+struct jps {
+    const struct grid *g;
+    const uint8_t *cost;
+    int stop, stopy, stopx;
+    int dirs;           // CARDINALS or ALLDIRS
+    struct search *ws;  // workspace: costs, parents, open set and the rough board
+};
+
+/* #################### FUNCTIONS ############################### */
+int jump(struct jps *s, int y, int x, int dy, int dx); // runs from y, x in one direction to the next jump point
+int hjump(struct jps *s, int y, int x, int dx); // horizontal jumps, a word of the row at a time
+bool iscalm(struct jps *s, int y, int x); // are the cell and all of its neighbours open ground?
+const uint64_t *roughrow(struct jps *s, int y); // row y of the rough board, filled on first use
+int jpsheuristic(struct jps *s, int key); // distance estimate from key to the stop
+int sign(int n); // -1, 0 or 1
+struct node *jpstolist(const struct grid *g, struct pool *p, int cameFrom[], int stop); // writes the path, filling in the jumps
+/* ############################################################## */
+
+// jump point search from start to stop over the dirs neighbourhood
+// one to one, returns the path as a list of every cell from start to stop,
+// from the workspace's pool
+struct node *jps(struct search *ws, const struct grid *g, const uint8_t moveCost[], int start, int stop, int dirs)
+{
+    if (jps_search(ws, g, moveCost, start, stop, dirs))
+        return jpstolist(g, &ws->nodes, ws->cameFrom, stop);
+    return NULL; // failure to path find
+}
+
+// the search of jps, leaves the jump points of the path in the workspace's
+// cameFrom and returns whether stop was reached
+bool jps_search(struct search *ws, const struct grid *g, const uint8_t moveCost[], int start, int stop, int dirs)
+{
+    struct jps s = { g, moveCost, stop, gety(g, stop), getx(g, stop), dirs, ws };
+    struct pqueue *frontier = &ws->open; // priority queue of jump points to visit
+    int *cameFrom = ws->cameFrom; // the jump point each one was reached from
+    int parent, child;      // parent = visited key, child = jump point reachable from parent
+    int pdy, pdx;           // direction the parent was entered in
+    int ndirs, dy[3], dx[3]; // directions to jump in from the parent
+    int i, steps, cost;
+    bool found = false;
+
+    search_reset(ws);
+    search_visit(ws, start, 0, INVALID);
+    pqueue_push(frontier, start, 0);
+
+    while (!pqueue_empty(frontier) && !found)
+    {
+        parent = pqueue_pop(frontier);
+        if (parent != start && iscalm(&s, gety(g, parent), getx(g, parent)))
+        { // open ground: only the natural directions from the way it was entered
+            pdy = sign(gety(g, parent) - gety(g, cameFrom[parent]));
+            pdx = sign(getx(g, parent) - getx(g, cameFrom[parent]));
+            ndirs = 0;
+            dy[ndirs] = pdy, dx[ndirs++] = pdx; // straight on
+            if (pdy && pdx)
+            { // diagonal, also the two straight components
+                dy[ndirs] = pdy, dx[ndirs++] = 0;
+                dy[ndirs] = 0, dx[ndirs++] = pdx;
+            }
+            else if (pdy && dirs == CARDINALS)
+            { // vertical in 4 directions may turn either way
+                dy[ndirs] = 0, dx[ndirs++] = 1;
+                dy[ndirs] = 0, dx[ndirs++] = -1;
+            }
+        }
+        else
+        { // the start or rough ground: every direction, one cell at a time like astar
+            ndirs = 0;
+            for (i = 1; i < dirs; i++)
+            {
+                child = offsetkey(g, parent, y(i), x(i));
+                if (child == INVALID || moveCost[child] == COST_BLOCKED ||
+                    (cost = ws->costTo[parent] + moveCost[child]) >= search_cost(ws, child))
+                    continue;
+                search_visit(ws, child, cost, parent);
+                if (child == stop)
+                    break;
+                pqueue_push(frontier, child, cost + jpsheuristic(&s, child));
+            }
+            found = i < dirs; // found goal
+            continue;
+        }
+
+        for (i = 0; i < ndirs && !found; i++)
+        {
+            if ((child = jump(&s, gety(g, parent), getx(g, parent), dy[i], dx[i])) == INVALID)
+                continue;
+            steps = abs(gety(g, child) - gety(g, parent));
+            if (abs(getx(g, child) - getx(g, parent)) > steps)
+                steps = abs(getx(g, child) - getx(g, parent));
+            // every cell jumped over is open ground, the last one costs what it costs
+            cost = ws->costTo[parent] + (steps - 1) * UNIFORM + moveCost[child];
+            if (cost >= search_cost(ws, child))
+                continue;
+            search_visit(ws, child, cost, parent);
+            if (child == stop) // found goal?
+                found = true;
+            else
+                pqueue_push(frontier, child, cost + jpsheuristic(&s, child));
+        }
+    }
+    pqueue_purge(frontier); // leave the open set empty for the next search
+    return found;
+}
+
+// runs from y, x one step at a time in direction dy, dx and returns the key
+// of the first jump point, or INVALID if it runs into the edge of the map or
+// a blocked cell
+int jump(struct jps *s, int y, int x, int dy, int dx)
+{
+    const struct grid *g = s->g;
+    int key;
+
+    if (dy == 0)
+        return hjump(s, y, x, dx);
+    for (;;)
+    {
+        y += dy;
+        x += dx;
+        if (y < 0 || y >= g->height || x < 0 || x >= g->width)
+            return INVALID;
+        key = hash(g, y, x);
+        if (s->cost[key] == COST_BLOCKED)
+            return INVALID;
+        if (key == s->stop || !iscalm(s, y, x))
+            return key; // the goal, or rough ground close by: expand it like astar
+        if (dx)
+        { // diagonal: stop where either straight component finds something
+            if (jump(s, y, x, dy, 0) != INVALID || hjump(s, y, x, dx) != INVALID)
+                return key;
+        }
+        else if (s->dirs == CARDINALS)
+        { // vertical in 4 directions: stop where the row holds something to turn to
+            if (hjump(s, y, x, 1) != INVALID || hjump(s, y, x, -1) != INVALID)
+                return key;
+        }
+    }
+}
+
+// horizontal jump from y, x in direction dx. A cell is a jump point when
+// any of the three rows around it has rough ground in the columns around it,
+// so the three rows are or'd together, widened by a column each way, and
+// the first set bit past x is the jump point. 64 cells per step
+int hjump(struct jps *s, int y, int x, int dx)
+{
+    const uint64_t *above = roughrow(s, y - 1), *row = roughrow(s, y), *below = roughrow(s, y + 1);
+    uint64_t *near = s->ws->near;
+    uint64_t m;
+    int words = s->ws->rough.words;
+    int w, hit = INVALID, key;
+
+    for (w = 0; w < words; w++)
+        near[w] = above[w] | row[w] | below[w];
+    for (w = 0; w < words; w++)
+    { // widen, carrying bits across word edges. near[w - 1] is already widened, so read the raw rows
+        m = near[w] | near[w] << 1 | near[w] >> 1;
+        if (w > 0)
+            m |= (above[w - 1] | row[w - 1] | below[w - 1]) >> 63;
+        if (w + 1 < words)
+            m |= near[w + 1] << 63;
+        near[w] = m;
+    }
+    if (dx > 0)
+    {
+        for (w = (x + 1) / 64; w < words && hit == INVALID; w++)
+            if ((m = near[w] & (w == (x + 1) / 64 ? ~(uint64_t) 0 << (x + 1) % 64 : ~(uint64_t) 0)))
+                hit = w * 64 + __builtin_ctzll(m);
+        if (hit >= s->g->width)
+            hit = INVALID; // ran off the edge
+    }
+    else if (x > 0)
+    {
+        for (w = (x - 1) / 64; w >= 0 && hit == INVALID; w--)
+            if ((m = near[w] & (w == (x - 1) / 64 ? ~(uint64_t) 0 >> (63 - (x - 1) % 64) : ~(uint64_t) 0)))
+                hit = w * 64 + 63 - __builtin_clzll(m);
+    }
+    if (y == s->stopy && sign(s->stopx - x) == dx &&
+        (hit == INVALID || abs(s->stopx - x) < abs(hit - x)))
+        return s->stop; // the goal comes first
+    if (hit == INVALID)
+        return INVALID;
+    key = hash(s->g, y, hit);
+    return s->cost[key] == COST_BLOCKED ? INVALID : key;
+}
+
+// returns whether the cell and its eight neighbours are all open ground.
+// The edge of the map doesn't count against it, a straight wall never
+// forces a turn
+bool iscalm(struct jps *s, int y, int x)
+{
+    const uint64_t *row;
+    int r, c;
+
+    for (r = y - 1; r <= y + 1; r++)
+    {
+        row = roughrow(s, r);
+        for (c = x - 1; c <= x + 1; c++)
+            if (c >= 0 && c < s->g->width && row[c / 64] >> (c % 64) & 1)
+                return false;
+    }
+    return true;
+}
+
+// returns row y of the rough board, the cells that aren't open ground.
+// Rows are filled from the cost plane the first time a search looks at them,
+// rows off the map are left empty
+const uint64_t *roughrow(struct jps *s, int y)
+{
+    struct search *ws = s->ws;
+    uint64_t *row = ws->rough.bits + (y + 1) * ws->rough.words; // padding row is row 0
+    int x;
+
+    if (y >= 0 && y < s->g->height && ws->rowstamp[y] != ws->gen)
+    { // left over from an earlier search
+        memset(row, 0, ws->rough.words * sizeof(uint64_t));
+        for (x = 0; x < s->g->width; x++)
+            if (s->cost[hash(s->g, y, x)] != UNIFORM)
+                row[x / 64] |= (uint64_t) 1 << (x % 64);
+        ws->rowstamp[y] = ws->gen;
+    }
+    return row;
+}
+
+// distance estimate from key to the stop: manhattan distance with 4
+// directions, the longer axis with 8 since a diagonal step costs the same
+int jpsheuristic(struct jps *s, int key)
+{
+    int dy = abs(gety(s->g, key) - gety(s->g, s->stop));
+    int dx = abs(getx(s->g, key) - getx(s->g, s->stop));
+
+    if (s->dirs == CARDINALS)
+        return dy + dx;
+    return dy > dx ? dy : dx;
+}
+
+// returns -1, 0 or 1 for the sign of n
+int sign(int n)
+{
+    return (n > 0) - (n < 0);
+}
+
+// writes the path into a linked list, start to stop. Consecutive jump points
+// are in a straight or diagonal line, so the cells between are filled in by
+// stepping from each jump point back towards the one it was reached from
+struct node *jpstolist(const struct grid *g, struct pool *p, int cameFrom[], int stop)
+{
+    struct node *path = NULL;
+    int curr, from, dy, dx;
+
+    for (curr = stop; curr != INVALID; curr = from)
+    {
+        from = cameFrom[curr];
+        nodelist_prepend(p, &path, curr);
+        if (from == INVALID)
+            break;
+        dy = sign(gety(g, from) - gety(g, curr));
+        dx = sign(getx(g, from) - getx(g, curr));
+        for (curr = offsetkey(g, curr, dy, dx); curr != from; curr = offsetkey(g, curr, dy, dx))
+            nodelist_prepend(p, &path, curr);
+    }
+    return path;
+}
@@ -0,0 +1,442 @@
+/******************************************************************************
+
+Many to many path queries
+
+A batch of (start, stop) queries over one cost plane, answered together
+instead of a search per pair. Queries that share a start are answered by
+one Dijkstra from it, run until every stop of the group is settled; of the
+rest, queries that share a stop by one Dijkstra backwards from it, run
+until every start is settled. Queries left on their own go to findpath.
+
+Groups run on a pool of workers, each with a workspace and a buffer for
+the paths it finds, both kept between batches. Once every group is done
+the paths are copied into one buffer in query order, each query told where
+its path starts, so the result doesn't depend on the number of threads.
+A query whose start is its stop is the one key path at cost 0, answered
+there without joining a group.
+
+Moves are the 4 directions astar uses, costing the cell entered. A start
+on a blocked cell can be left, a blocked stop can't be entered, so it has
+no path however the query is grouped.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+// how a group of queries is searched
+enum { GROUP_SINGLE, GROUP_START, GROUP_STOP };
+
+// queries answered by one search, a run of the batch's order
+struct group {
+    int kind;               // GROUP_SINGLE, GROUP_START or GROUP_STOP
+    int first, n;           // order[first .. first + n - 1]
+};
+
+// one run of multipath_run, shared by the workers
+struct mpbatch {
+    struct multipath *m;
+    const uint8_t *cost;
+    struct query *q;
+    struct group *groups;
+    bool *failed;           // a flag per worker, set if it ran out of memory
+};
+
+// a query index and the key it is grouped by
+struct mpkey {
+    int key, index;
+};
+
+/* #################### FUNCTIONS ############################### */
+int mp_group(struct multipath *m, struct query q[], int n, struct group groups[]); // orders and groups the queries
+void mp_sort(int order[], int n, const struct query q[], bool bystop, struct mpkey tmp[]); // sorts indices by start or stop
+int mpkeycmp(const void *a, const void *b); // by key, then index
+void mp_job(void *ctx, int worker, long i); // answers one group
+void mp_forward(struct mpbatch *b, struct search *s, const struct group *gr); // Dijkstra from a shared start
+void mp_backward(struct mpbatch *b, struct search *s, const struct group *gr); // Dijkstra back from a shared stop
+bool mp_keep(struct multipath *m, int worker, struct query *q, const struct search *s); // copies a forward path out
+bool mp_keepback(struct multipath *m, int worker, struct query *q, const struct search *s); // copies a backward path out
+int *mp_room(struct path *p, int n); // makes room for n more keys at the end of p
+/* ############################################################## */
+
+// starts a batch runner for grid g on threads workers. Workspaces are
+// made on first use. FAILURE if out of memory
+bool multipath_init(struct multipath *m, const struct grid *g, int threads)
+{
+    memset(m, 0, sizeof(*m));
+    m->grid = *g;
+    m->nworkers = threads > 0 ? threads : 1;
+    m->ws = calloc(m->nworkers, sizeof(struct search));
+    m->part = calloc(m->nworkers, sizeof(struct path));
+    if (!m->ws || !m->part)
+    {
+        multipath_free(m);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+// frees the runner, its workspaces and the paths of the last batch
+void multipath_free(struct multipath *m)
+{
+    int i;
+
+    for (i = 0; m->ws && i < m->nworkers; i++)
+        if (m->ws[i].size)
+            search_free(&m->ws[i]);
+    for (i = 0; m->part && i < m->nworkers; i++)
+        free(m->part[i].keys);
+    free(m->ws);
+    free(m->part);
+    free(m->keys);
+    free(m->order);
+    free(m->owner);
+    memset(m, 0, sizeof(*m));
+    return;
+}
+
+// answers the n queries over moveCost. Each query's path is m->keys[at]
+// .. m->keys[at + len - 1], start to stop, with its cost; len is 0 and at
+// INVALID if there is none. The keys stay until the next batch. FAILURE if
+// out of memory
+bool multipath_run(struct multipath *m, const uint8_t moveCost[], struct query q[], int n)
+{
+    struct mpbatch b = { m, moveCost, q, NULL, NULL };
+    int i, ngroups, total, *keys;
+    bool ok = SUCCESS;
+
+    if (n > m->ordercap)
+    {
+        if (!(keys = realloc(m->order, n * sizeof(int))))
+            return FAILURE;
+        m->order = keys;
+        if (!(keys = realloc(m->owner, n * sizeof(int))))
+            return FAILURE; // order has grown, ordercap still holds for both
+        m->owner = keys;
+        m->ordercap = n;
+    }
+    b.groups = malloc((n ? n : 1) * sizeof(struct group));
+    b.failed = calloc(m->nworkers, sizeof(bool));
+    for (i = 0; b.groups && b.failed && i < m->nworkers; i++)
+    {
+        if (!m->ws[i].size && search_init(&m->ws[i], &m->grid) == FAILURE)
+            break;
+        m->part[i].len = 0;
+    }
+    if (!b.groups || !b.failed || i < m->nworkers || (ngroups = mp_group(m, q, n, b.groups)) == INVALID)
+    {
+        free(b.groups);
+        free(b.failed);
+        return FAILURE;
+    }
+    if (m->nworkers > 1 && ngroups > 1)
+        sched_run(ngroups < m->nworkers ? ngroups : m->nworkers, ngroups, mp_job, &b);
+    else
+        for (i = 0; i < ngroups; i++)
+            mp_job(&b, 0, i);
+    for (i = 0; i < m->nworkers; i++)
+        if (b.failed[i])
+            ok = FAILURE;
+    free(b.groups);
+    free(b.failed);
+    if (ok == FAILURE)
+        return FAILURE;
+
+    // one buffer, in query order
+    for (i = total = 0; i < n; i++)
+        total += q[i].len;
+    if (total > m->cap)
+    {
+        if (!(keys = realloc(m->keys, total * sizeof(int))))
+            return FAILURE;
+        m->keys = keys;
+        m->cap = total;
+    }
+    for (i = m->len = 0; i < n; i++)
+    {
+        if (q[i].len == 0)
+            continue;
+        if (q[i].start == q[i].stop)
+            m->keys[m->len] = q[i].start;
+        else
+            memcpy(m->keys + m->len, m->part[m->owner[i]].keys + q[i].at, q[i].len * sizeof(int));
+        q[i].at = m->len;
+        m->len += q[i].len;
+    }
+    return SUCCESS;
+}
+
+// orders the queries into groups: runs of a shared start, then of the rest
+// runs of a shared stop, then the queries left one by one. A query whose
+// start is its stop is in none, its path is the one key. Returns the
+// number of groups written to groups, INVALID if out of memory
+int mp_group(struct multipath *m, struct query q[], int n, struct group groups[])
+{
+    int *order = m->order;
+    struct mpkey *tmp = malloc((n ? n : 1) * sizeof(struct mpkey));
+    int i, j, k, swap, rest, ngroups = 0;
+
+    for (i = k = 0; i < n; i++)
+    {
+        q[i].at = INVALID;
+        q[i].len = q[i].cost = 0;
+        if (q[i].start == q[i].stop)
+            q[i].len = 1; // copied in with the others
+        else
+            order[k++] = i;
+    }
+    n = k;
+    if (!tmp)
+        return INVALID;
+    mp_sort(order, n, q, false, tmp);
+    for (i = rest = 0; i < n; i = j)
+    { // shared starts to the front, the rest after them
+        for (j = i + 1; j < n && q[order[j]].start == q[order[i]].start; j++)
+            ;
+        if (j - i < 2)
+            continue;
+        groups[ngroups].kind = GROUP_START;
+        groups[ngroups].first = rest;
+        groups[ngroups++].n = j - i;
+        for (k = i; k < j; k++)
+        { // the run moves down over queries already passed over
+            swap = order[rest];
+            order[rest++] = order[k];
+            order[k] = swap;
+        }
+    }
+    mp_sort(order + rest, n - rest, q, true, tmp);
+    for (i = rest; i < n; i = j)
+    {
+        for (j = i + 1; j < n && q[order[j]].stop == q[order[i]].stop; j++)
+            ;
+        groups[ngroups].kind = j - i < 2 ? GROUP_SINGLE : GROUP_STOP;
+        groups[ngroups].first = i;
+        groups[ngroups++].n = j - i;
+    }
+    free(tmp);
+    return ngroups;
+}
+
+// sorts n query indices by start, or by stop, then by index, so the
+// groups never depend on the sort. tmp holds n keys
+void mp_sort(int order[], int n, const struct query q[], bool bystop, struct mpkey tmp[])
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        tmp[i].key = bystop ? q[order[i]].stop : q[order[i]].start;
+        tmp[i].index = order[i];
+    }
+    qsort(tmp, n, sizeof(struct mpkey), mpkeycmp);
+    for (i = 0; i < n; i++)
+        order[i] = tmp[i].index;
+    return;
+}
+
+// qsort order for grouping keys: by key, then by query index
+int mpkeycmp(const void *a, const void *b)
+{
+    const struct mpkey *x = a, *y = b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->index - y->index;
+}
+
+// answers group i on the worker's workspace
+void mp_job(void *ctx, int worker, long i)
+{
+    struct mpbatch *b = ctx;
+    struct multipath *m = b->m;
+    struct search *s = &m->ws[worker];
+    const struct group *gr = &b->groups[i];
+    struct query *q = &b->q[m->order[gr->first]];
+
+    if (gr->kind == GROUP_START)
+        mp_forward(b, s, gr);
+    else if (gr->kind == GROUP_STOP)
+        mp_backward(b, s, gr);
+    else
+    {
+        m->owner[m->order[gr->first]] = worker;
+        if (b->cost[q->stop] != COST_BLOCKED && findpath_search(s, &m->grid, b->cost, q->start, q->stop) &&
+            mp_keep(m, worker, q, s) == FAILURE)
+            b->failed[worker] = true;
+    }
+    return;
+}
+
+// Dijkstra from the group's start until all of its stops are settled, each
+// path copied out as its stop is reached. The stops are marked in the
+// workspace's closed stamps
+void mp_forward(struct mpbatch *b, struct search *s, const struct group *gr)
+{
+    const struct grid *g = &b->m->grid;
+    const uint8_t *moveCost = b->cost;
+    const int *order = b->m->order + gr->first;
+    int worker = s - b->m->ws;
+    int i, u, v, cost, left = 0;
+
+    if (!s->closed && !(s->closed = calloc(s->size, sizeof(uint32_t))))
+    {
+        b->failed[worker] = true;
+        return;
+    }
+    search_reset(s);
+    for (i = 0; i < gr->n; i++)
+    {
+        b->m->owner[order[i]] = worker;
+        if (moveCost[b->q[order[i]].stop] != COST_BLOCKED && s->closed[b->q[order[i]].stop] != s->gen)
+        { // a blocked stop is never reached, no use waiting for it
+            s->closed[b->q[order[i]].stop] = s->gen;
+            left++;
+        }
+    }
+    search_visit(s, b->q[order[0]].start, 0, INVALID);
+    pqueue_push(&s->open, b->q[order[0]].start, 0);
+    while (left > 0 && (u = pqueue_pop(&s->open)) != INVALID)
+    {
+        if (s->closed[u] == s->gen)
+        {
+            s->closed[u] = 0; // settled
+            left--;
+        }
+        for (i = 1; i < CARDINALS; i++)
+        {
+            v = offsetkey(g, u, y(i), x(i));
+            if (v == INVALID || moveCost[v] == COST_BLOCKED ||
+                (cost = s->costTo[u] + moveCost[v]) >= search_cost(s, v))
+                continue;
+            search_visit(s, v, cost, u);
+            pqueue_push(&s->open, v, cost);
+        }
+    }
+    pqueue_purge(&s->open);
+    for (i = 0; i < gr->n; i++)
+        if (search_cost(s, b->q[order[i]].stop) != MAX_STEPS)
+            if (mp_keep(b->m, worker, &b->q[order[i]], s) == FAILURE)
+                b->failed[worker] = true;
+    return;
+}
+
+// Dijkstra backwards from the group's stop until all of its starts are
+// settled. A move costs the cell entered, so backwards it costs the cell
+// left, and each start's path follows cameTo to the stop. A blocked cell
+// is reached, as it may be a start, but never stepped through
+void mp_backward(struct mpbatch *b, struct search *s, const struct group *gr)
+{
+    const struct grid *g = &b->m->grid;
+    const uint8_t *moveCost = b->cost;
+    const int *order = b->m->order + gr->first;
+    int worker = s - b->m->ws;
+    int i, u, v, cost, left = 0, stop = b->q[order[0]].stop;
+
+    if (search_back(s) == FAILURE || (!s->closed && !(s->closed = calloc(s->size, sizeof(uint32_t)))))
+    {
+        b->failed[worker] = true;
+        return;
+    }
+    search_reset(s);
+    for (i = 0; i < gr->n; i++)
+        b->m->owner[order[i]] = worker;
+    if (moveCost[stop] == COST_BLOCKED)
+        return; // no path
+    for (i = 0; i < gr->n; i++)
+    {
+        if (s->closed[b->q[order[i]].start] != s->gen)
+        {
+            s->closed[b->q[order[i]].start] = s->gen;
+            left++;
+        }
+    }
+    s->stampTo[stop] = s->gen;
+    s->costFrom[stop] = 0;
+    s->cameTo[stop] = INVALID;
+    pqueue_push(&s->back, stop, 0);
+    while (left > 0 && (u = pqueue_pop(&s->back)) != INVALID)
+    {
+        if (s->closed[u] == s->gen)
+        {
+            s->closed[u] = 0;
+            left--;
+        }
+        if (moveCost[u] == COST_BLOCKED)
+            continue; // a start, left but never entered
+        for (i = 1; i < CARDINALS; i++)
+        {
+            v = offsetkey(g, u, y(i), x(i));
+            if (v == INVALID)
+                continue;
+            cost = s->costFrom[u] + moveCost[u];
+            if (s->stampTo[v] == s->gen && cost >= s->costFrom[v])
+                continue;
+            s->stampTo[v] = s->gen;
+            s->costFrom[v] = cost;
+            s->cameTo[v] = u;
+            pqueue_push(&s->back, v, cost);
+        }
+    }
+    pqueue_purge(&s->back);
+    for (i = 0; i < gr->n; i++)
+        if (s->stampTo[b->q[order[i]].start] == s->gen)
+            if (mp_keepback(b->m, worker, &b->q[order[i]], s) == FAILURE)
+                b->failed[worker] = true;
+    return;
+}
+
+// copies the path the workspace found to q's stop onto the end of the
+// worker's buffer, noting where it went. FAILURE if out of memory
+bool mp_keep(struct multipath *m, int worker, struct query *q, const struct search *s)
+{
+    struct path *part = &m->part[worker], view;
+
+    view.cap = 0;
+    view.keys = NULL;
+    search_path(s, &m->grid, q->stop, &view); // measures it
+    if (!(view.keys = mp_room(part, view.len)))
+        return FAILURE;
+    view.cap = view.len;
+    search_path(s, &m->grid, q->stop, &view);
+    q->at = part->len;
+    q->len = view.len;
+    q->cost = view.cost;
+    part->len += view.len;
+    return SUCCESS;
+}
+
+// copies the path from q's start along cameTo to the stop onto the end of
+// the worker's buffer, noting where it went. FAILURE if out of memory
+bool mp_keepback(struct multipath *m, int worker, struct query *q, const struct search *s)
+{
+    struct path *part = &m->part[worker];
+    int key, len = 0, *keys;
+
+    for (key = q->start; key != INVALID; key = s->cameTo[key])
+        len++;
+    if (!(keys = mp_room(part, len)))
+        return FAILURE;
+    for (key = q->start; key != INVALID; key = s->cameTo[key])
+        *keys++ = key;
+    q->at = part->len;
+    q->len = len;
+    q->cost = s->costFrom[q->start];
+    part->len += len;
+    return SUCCESS;
+}
+
+// returns where n more keys go at the end of p, grown if needed, NULL if
+// out of memory
+int *mp_room(struct path *p, int n)
+{
+    int *keys;
+
+    if (p->len + n > p->cap)
+    {
+        if (!(keys = realloc(p->keys, (p->len + n) * 2 * sizeof(int))))
+            return NULL;
+        p->keys = keys;
+        p->cap = (p->len + n) * 2;
+    }
+    return p->keys + p->len;
+}
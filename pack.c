@@ -0,0 +1,315 @@
+/******************************************************************************
+
+Level packs
+
+A binary file of many levels, written by dungen-batch and mapped straight
+into memory by the loader, so a pack of thousands of levels opens in the
+time it takes to map it and every level is read in place.
+
+	header          PACK_MAGIC, PACK_VERSION
+	level records   one per level, in the order written
+	index           the offset of each level's record, by level number
+	footer          where the index starts, how many levels, PACK_MAGIC
+
+A level record is a struct packlevel followed by its rooms, its points (the
+links the corridors start from, and stairs) and its tiles, row by row,
+either a byte per cell (PACK_RAW) or as pairs of run length and tile
+(PACK_RLE). Records are padded to 8 bytes so every struct in the file is
+aligned where it lies. Numbers are in the byte order of the machine that
+wrote the pack: on a machine of the other order the version doesn't match
+and the pack is refused. The footer at the end lets the pack be written to a
+pipe, levels in whatever order they finish.
+
+*******************************************************************************/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rl.h"
+
+#define PACK_MAGIC      "DUNGPACK"  // first and last 8 bytes of a pack
+#define PACK_ALIGN      8           // records start on this boundary
+#define RLE_RUN         UINT8_MAX   // longest run one pair holds
+
+// start of a pack
+struct packheader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+// end of a pack
+struct packfooter {
+    uint64_t index;         // offset of the index, count offsets
+    uint64_t count;         // levels in the pack
+    char magic[8];
+};
+
+/* #################### FUNCTIONS ############################### */
+size_t rle_pack(const uint8_t in[], size_t n, uint8_t out[]); // run length pairs of in, out NULL to only measure
+bool rle_unpack(const uint8_t in[], size_t n, uint8_t out[], size_t cells); // expands pairs into exactly cells bytes
+bool isstair(int tile); // does the tile go in the points table?
+/* ############################################################## */
+
+// packs the dungeon's level into a record in a new buffer, tiles encoded as
+// PACK_RAW or PACK_RLE, and sets len to its size. The caller frees it.
+// NULL if out of memory
+uint8_t *pack_dungeon(const struct dungeon *d, int encoding, size_t *len)
+{
+    const struct grid *g = &d->grid;
+    struct packlevel *l;
+    struct packroom *room;
+    struct packpoint *point;
+    struct room *r;
+    uint8_t *rows = malloc(g->area), *buf, *tiles;
+    int y, x, i, nstairs = 0;
+    size_t ntiles, size;
+
+    if (!rows)
+        return NULL;
+    for (y = i = 0; y < g->height; y++)
+        for (x = 0; x < g->width; x++, i++)
+            nstairs += isstair(rows[i] = d->map[hash(g, y, x)]);
+    ntiles = encoding == PACK_RLE ? rle_pack(rows, g->area, NULL) : (size_t) g->area;
+    size = sizeof(struct packlevel) + d->rooms.n * sizeof(struct packroom) +
+           (d->nlinks + nstairs) * sizeof(struct packpoint) + ntiles;
+    size = (size + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+    if (!(buf = calloc(1, size)))
+    {
+        free(rows);
+        return NULL;
+    }
+
+    l = (struct packlevel *) buf;
+    l->size = size;
+    l->height = g->height;
+    l->width = g->width;
+    l->seed = d->seed;
+    l->level = d->level;
+    l->nrooms = d->rooms.n;
+    l->npoints = d->nlinks + nstairs;
+    l->ntiles = ntiles;
+    l->encoding = encoding;
+    room = (struct packroom *) (l + 1);
+    for (r = d->rooms.head; r; r = r->next, room++)
+    {
+        room->y = gety(g, r->coords);
+        room->x = getx(g, r->coords);
+        room->height = r->height;
+        room->width = r->width;
+    }
+    point = (struct packpoint *) room;
+    for (i = 0; i < d->nlinks; i++, point++)
+    {
+        point->y = gety(g, d->links[i]);
+        point->x = getx(g, d->links[i]);
+        point->tile = LINK; // carved over by its corridor, so only kept here
+    }
+    for (i = 0; nstairs && i < g->area; i++)
+        if (isstair(rows[i]))
+        {
+            point->y = i / g->width;
+            point->x = i % g->width;
+            (point++)->tile = rows[i];
+            nstairs--;
+        }
+    tiles = (uint8_t *) point;
+    if (encoding == PACK_RLE)
+        rle_pack(rows, g->area, tiles);
+    else
+        memcpy(tiles, rows, g->area);
+    free(rows);
+    *len = size;
+    return buf;
+}
+
+// writes the start of a pack, returns the bytes written
+size_t pack_begin(FILE *fp)
+{
+    struct packheader h;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PACK_MAGIC, sizeof(h.magic));
+    h.version = PACK_VERSION;
+    return fwrite(&h, 1, sizeof(h), fp);
+}
+
+// writes the end of a pack: the record offset of each of the count levels
+// and the footer. at is the offset the index lands on, the bytes written so far
+void pack_end(FILE *fp, const uint64_t index[], uint64_t count, uint64_t at)
+{
+    struct packfooter f;
+
+    fwrite(index, sizeof(uint64_t), count, fp);
+    f.index = at;
+    f.count = count;
+    memcpy(f.magic, PACK_MAGIC, sizeof(f.magic));
+    fwrite(&f, 1, sizeof(f), fp);
+    return;
+}
+
+// maps the pack at path into memory and checks it, FAILURE with an error on
+// stderr if it can't be read or isn't a pack of this version
+bool pack_open(struct pack *p, const char *path)
+{
+    const struct packheader *h;
+    const struct packfooter *f;
+    const struct packlevel *l;
+    struct stat st;
+    uint64_t i;
+    int fd;
+
+    memset(p, 0, sizeof(*p));
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return FAILURE;
+    }
+    p->size = st.st_size;
+    p->base = p->size >= sizeof(*h) + sizeof(*f) ? mmap(NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd); // the mapping stays
+    if (p->base == MAP_FAILED)
+    {
+        p->base = NULL;
+        fprintf(stderr, "%s: not a level pack\n", path);
+        return FAILURE;
+    }
+    h = (const struct packheader *) p->base;
+    f = (const struct packfooter *) (p->base + p->size - sizeof(*f));
+    if (memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) ||
+        h->version != PACK_VERSION || memcmp(f->magic, PACK_MAGIC, sizeof(f->magic)) ||
+        f->index % PACK_ALIGN || f->index < sizeof(*h) || f->index > p->size - sizeof(*f) ||
+        f->count > (p->size - sizeof(*f) - f->index) / sizeof(uint64_t))
+    {
+        fprintf(stderr, "%s: not a level pack of version %d\n", path, PACK_VERSION);
+        pack_close(p);
+        return FAILURE;
+    }
+    p->count = f->count;
+    p->index = (const uint64_t *) (p->base + f->index);
+    for (i = 0; i < p->count; i++)
+    { // every record within the levels and whole, so reading one never checks
+        l = (const struct packlevel *) (p->base + p->index[i]);
+        if (f->index < sizeof(*l) || p->index[i] % PACK_ALIGN || p->index[i] < sizeof(*h) ||
+            p->index[i] > f->index - sizeof(*l) ||
+            l->size > f->index - p->index[i] || l->size < sizeof(*l) + l->nrooms * sizeof(struct packroom) +
+            (uint64_t) l->npoints * sizeof(struct packpoint) + l->ntiles ||
+            (l->encoding != PACK_RAW && l->encoding != PACK_RLE))
+        {
+            fprintf(stderr, "%s: level %" PRIu64 " is damaged\n", path, i);
+            pack_close(p);
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+// unmaps the pack, every pointer into it goes with it
+void pack_close(struct pack *p)
+{
+    if (p->base)
+        munmap((void *) p->base, p->size);
+    memset(p, 0, sizeof(*p));
+    return;
+}
+
+// returns the record of level i of the pack, in place, NULL if out of range
+const struct packlevel *pack_level(const struct pack *p, uint64_t i)
+{
+    return i < p->count ? (const struct packlevel *) (p->base + p->index[i]) : NULL;
+}
+
+// returns the record's room table, nrooms long
+const struct packroom *packlevel_rooms(const struct packlevel *l)
+{
+    return (const struct packroom *) (l + 1);
+}
+
+// returns the record's points, npoints long: the links, then any stairs
+const struct packpoint *packlevel_points(const struct packlevel *l)
+{
+    return (const struct packpoint *) (packlevel_rooms(l) + l->nrooms);
+}
+
+// returns the record's tiles, ntiles bytes, as encoded
+const uint8_t *packlevel_tiles(const struct packlevel *l)
+{
+    return (const uint8_t *) (packlevel_points(l) + l->npoints);
+}
+
+// writes the record's tiles into map, a plane of a grid of the level's
+// dimensions in any layout. FAILURE if the dimensions differ or the tiles
+// don't decode, or are in an encoding this loader doesn't know
+bool pack_unpack(const struct packlevel *l, const struct grid *g, uint8_t map[])
+{
+    const uint8_t *tiles = packlevel_tiles(l);
+    uint8_t *rows;
+    bool ok;
+    int y;
+
+    if (g->height != l->height || g->width != l->width || (l->encoding != PACK_RAW && l->encoding != PACK_RLE))
+        return FAILURE;
+    if (l->encoding == PACK_RAW && g->layout == LAYOUT_ROWS)
+    { // row keys are row by row already
+        if (l->ntiles != (uint32_t) g->area)
+            return FAILURE;
+        for (y = 0; y < g->height; y++)
+            memcpy(map + hash(g, y, 0), tiles + y * g->width, g->width);
+        return SUCCESS;
+    }
+    if (!(rows = malloc(g->area)))
+        return FAILURE;
+    if (l->encoding == PACK_RLE)
+        ok = rle_unpack(tiles, l->ntiles, rows, g->area);
+    else if ((ok = l->ntiles == (uint32_t) g->area))
+        memcpy(rows, tiles, g->area);
+    for (y = 0; ok && y < g->area; y++)
+        map[hash(g, y / g->width, y % g->width)] = rows[y];
+    free(rows);
+    return ok;
+}
+
+// writes in as pairs of run length and byte into out, or only counts them
+// if out is NULL. Returns the bytes the pairs take
+size_t rle_pack(const uint8_t in[], size_t n, uint8_t out[])
+{
+    size_t i = 0, run, len = 0;
+
+    while (i < n)
+    {
+        for (run = 1; i + run < n && run < RLE_RUN && in[i + run] == in[i]; run++)
+            ;
+        if (out)
+        {
+            out[len] = run;
+            out[len + 1] = in[i];
+        }
+        len += 2;
+        i += run;
+    }
+    return len;
+}
+
+// expands n bytes of pairs made by rle_pack into out, which takes exactly
+// cells bytes. FAILURE if the runs don't add up to cells
+bool rle_unpack(const uint8_t in[], size_t n, uint8_t out[], size_t cells)
+{
+    size_t i, at = 0;
+
+    for (i = 0; i + 1 < n; i += 2)
+    {
+        if (in[i] == 0 || at + in[i] > cells)
+            return FAILURE;
+        memset(out + at, in[i + 1], in[i]);
+        at += in[i];
+    }
+    return i == n && at == cells;
+}
+
+// returns whether the tile is a stair, kept in the points table
+bool isstair(int tile)
+{
+    return tile == UPSTAIRS || tile == DOWNSTAIRS;
+}
@@ -0,0 +1,148 @@
+/******************************************************************************
+
+Contiguous paths
+
+A search leaves its path in the workspace as a chain of cameFrom links from
+the stop back to the start (with jps only the jump points, in straight or
+diagonal lines). Instead of a linked list the path can be copied out to an
+array of keys the caller owns, start to stop, with its length and cost, so
+following it is a walk along memory and nothing is allocated per path.
+
+For storing many paths, a key array packs into a run length string of
+directions, a byte per straight run of up to RUN_MAX steps, and unpacks
+again from the start key.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+#define RUN_BITS    5                   // low bits of a run byte: steps - 1
+#define RUN_MAX     (1 << RUN_BITS)     // steps a run byte holds at most
+
+/* #################### FUNCTIONS ############################### */
+int step_toward(int from, int to); // -1, 0 or 1, the step from one coordinate towards another
+int dirindex(int dy, int dx); // direction of a one cell step, 1 .. ALLDIRS - 1, INVALID if none
+/* ############################################################## */
+
+// searches from start to stop with the selected algorithm and copies the
+// path into p, see search_path. Returns SUCCESS if a path was found and
+// fits, FAILURE with p->len 0 if there is none, or with p->len past p->cap
+// if the buffer is short. A start that is the stop is the one key path, at
+// cost 0, without a search: astar would reach the start again through a
+// neighbour and leave a loop in cameFrom. It is left in the workspace all
+// the same, so search_path copies it again like any other
+bool findpath_keys(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop, struct path *p)
+{
+    p->len = p->cost = 0;
+    if (start == stop)
+    {
+        search_reset(s);
+        search_visit(s, start, 0, INVALID);
+    }
+    else if (!findpath_search(s, g, moveCost, start, stop))
+        return FAILURE;
+    return search_path(s, g, stop, p) <= p->cap;
+}
+
+// copies the path the last search on s found to stop into p->keys, start to
+// stop, and sets p->len to its keys and p->cost to its move cost. Keys are
+// only written if they fit in p->cap, so a short buffer can be grown to
+// p->len and the path copied again, as long as s hasn't searched since.
+// Returns p->len
+int search_path(const struct search *s, const struct grid *g, int stop, struct path *p)
+{
+    int curr, from, i, len = 1;
+
+    for (curr = stop; (from = s->cameFrom[curr]) != INVALID; curr = from)
+    { // every link is a straight or diagonal line, as long as its longer axis
+        i = abs(gety(g, curr) - gety(g, from));
+        len += abs(getx(g, curr) - getx(g, from)) > i ? abs(getx(g, curr) - getx(g, from)) : i;
+    }
+    p->len = len;
+    p->cost = s->costTo[stop];
+    if (len > p->cap)
+        return len;
+    i = len;
+    for (curr = stop; ; curr = from)
+    { // back from the stop, filling in the cells between jump points
+        p->keys[--i] = curr;
+        if ((from = s->cameFrom[curr]) == INVALID)
+            break;
+        while ((curr = offsetkey(g, curr, step_toward(gety(g, curr), gety(g, from)),
+                                 step_toward(getx(g, curr), getx(g, from)))) != from)
+            p->keys[--i] = curr;
+    }
+    return len;
+}
+
+// packs the n keys of a path into rle, a byte per run of steps in one
+// direction: the direction in the high bits, steps - 1 in the low RUN_BITS.
+// Bytes are only written up to cap. Returns the bytes the path takes,
+// INVALID if two keys in a row aren't neighbours
+int path_encode(const struct grid *g, const int keys[], int n, uint8_t rle[], int cap)
+{
+    int i, dir, last = INVALID, run = 0, out = 0;
+
+    for (i = 1; i < n; i++)
+    {
+        dir = dirindex(gety(g, keys[i]) - gety(g, keys[i - 1]), getx(g, keys[i]) - getx(g, keys[i - 1]));
+        if (dir == INVALID)
+            return INVALID;
+        if (dir == last && run < RUN_MAX)
+            run++;
+        else
+        {
+            if (run && out < cap) // close the run before
+                rle[out] = (last - 1) << RUN_BITS | (run - 1);
+            out += run > 0;
+            last = dir;
+            run = 1;
+        }
+    }
+    if (run && out < cap)
+        rle[out] = (last - 1) << RUN_BITS | (run - 1);
+    return out + (run > 0);
+}
+
+// unpacks n bytes of rle made by path_encode into keys, from start. Keys
+// are only written up to cap. Returns the keys the path takes, INVALID if
+// it runs off the map
+int path_decode(const struct grid *g, int start, const uint8_t rle[], int n, int keys[], int cap)
+{
+    int i, j, dir, len = 0, key = start;
+
+    if (cap > 0)
+        keys[0] = start;
+    len++;
+    for (i = 0; i < n; i++)
+    {
+        dir = (rle[i] >> RUN_BITS) + 1;
+        for (j = (rle[i] & (RUN_MAX - 1)) + 1; j > 0; j--)
+        {
+            if ((key = offsetkey(g, key, y(dir), x(dir))) == INVALID)
+                return INVALID;
+            if (len < cap)
+                keys[len] = key;
+            len++;
+        }
+    }
+    return len;
+}
+
+// returns -1, 0 or 1, the step from coordinate from towards to
+int step_toward(int from, int to)
+{
+    return (to > from) - (to < from);
+}
+
+// returns the direction, as numbered by y() and x(), of a step of dy, dx,
+// INVALID if it isn't a step to a neighbour
+int dirindex(int dy, int dx)
+{
+    int i;
+
+    for (i = 1; i < ALLDIRS; i++)
+        if (y(i) == dy && x(i) == dx)
+            return i;
+    return INVALID;
+}
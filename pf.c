@@ -6,320 +6,299 @@ Pathfinding algorithms
  
 #include "rl.h"
 
-#define CARDINALS 	5	// n, s, e, w
-#define ALLDIRS		9 	// n, s, e, w, ne, nw, se, sw
-
 /* #################### FUNCTIONS ############################### */
-int *create_Djikstra_Map(int moveCost[], int start); // uses djikstra pathfinding to return a path map
 // utility functions
-int x(int i); // given an iteration, return an x coord
-int y(int i); // given a key, return a y coord
-void init(int *map, int val); // initialize map
-void fprintArray(int array[], int step);
-bool isValid(int key); // returns whether a key is valid
-void report(int cameFrom[], int stop); // record output (path)
-struct node *pathtolist(int cameFrom[], int stop); // writes path from array data into a linked list
-// priority queue functions
-struct node *newNode(int key, int priority); // creates a node with value key and priority
-void pqueue_push(struct node **queue, int key, int priority); // push a new key to the end of the queue
-int pqueue_pop(struct node **queue); // pop the priority queue
-void pqueue_purge(struct node **queue); // free()s all remaining nodes in the queue
+void fprintArray(const struct grid *g, int array[], int step);
+void report(const struct grid *g, int cameFrom[], int stop); // record output (path)
+struct node *pathtolist(struct pool *p, int cameFrom[], int stop); // writes path from array data into a linked list
 /* ############################################################## */
 
+static int openset = PQ_BUCKET; // priority queue backend, move costs are small integers
+static int pathfinder = PF_ASTAR; // algorithm findpath uses
+
+// offsets of each direction: none, e, w, n, s, se, nw, ne, sw. The cardinals
+// come first, so CARDINALS and ALLDIRS bound the loops over either set
+static const int dy[ALLDIRS] = { 0, 0, 0, 1, -1, 1, -1, -1, 1 };
+static const int dx[ALLDIRS] = { 0, 1, -1, 0, 0, 1, -1, 1, -1 };
+
+// select the priority queue backend used by the pathfinders
+void set_openset(int type)
+{
+    openset = type;
+    return;
+}
+
+// returns the priority queue backend used by the pathfinders
+int get_openset(void)
+{
+    return openset;
+}
+
+// select the algorithm findpath uses
+void set_pathfinder(int type)
+{
+    pathfinder = type;
+    return;
+}
+
+// pathfinder for a name given on the command line, INVALID if unknown
+int parse_pathfinder(const char *name)
+{
+    if (strcmp(name, "astar") == 0)
+        return PF_ASTAR;
+    else if (strcmp(name, "jps") == 0)
+        return PF_JPS;
+    else
+        return INVALID;
+}
+
+// finds a path from start to stop over the 4 cardinal directions with the
+// selected algorithm. The path's nodes come from the workspace's pool, give
+// them back with nodelist_purge(&s->nodes, &path)
+struct node *findpath(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop)
+{
+    if (pathfinder == PF_JPS)
+        return jps(s, g, moveCost, start, stop, CARDINALS);
+    return astar(s, g, moveCost, start, stop);
+}
+
+// the search of findpath, leaves the path in the workspace, see search_path,
+// and returns whether stop was reached
+bool findpath_search(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop)
+{
+    if (pathfinder == PF_JPS)
+        return jps_search(s, g, moveCost, start, stop, CARDINALS);
+    return astar_search(s, g, moveCost, start, stop);
+}
+
+// allocates a workspace for searches on the grid. The open set backend is
+// the one selected when the workspace is made
+bool search_init(struct search *s, const struct grid *g)
+{
+    memset(s, 0, sizeof(*s));
+    s->size = g->size;
+    s->costTo = malloc(g->size * sizeof(int));
+    s->cameFrom = malloc(g->size * sizeof(int));
+    s->stamp = calloc(g->size, sizeof(uint32_t));
+    s->rowstamp = calloc(g->height, sizeof(uint32_t));
+    s->gen = 1; // nothing is stamped with it yet
+    pool_init(&s->nodes, sizeof(struct node), 1024);
+    if (!s->costTo || !s->cameFrom || !s->stamp || !s->rowstamp ||
+        pqueue_init(&s->open, openset, g->size) == FAILURE ||
+        bitboard_init(&s->rough, g->height + 2, g->width) == FAILURE || // a row of padding above and below
+        !(s->near = malloc(s->rough.words * sizeof(uint64_t))))
+    {
+        search_free(s);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+// frees the workspace's buffers
+void search_free(struct search *s)
+{
+    free(s->costTo);
+    free(s->cameFrom);
+    free(s->stamp);
+    free(s->rowstamp);
+    free(s->near);
+    free(s->closed);
+    free(s->costFrom);
+    free(s->cameTo);
+    free(s->stampTo);
+    pqueue_free(&s->open);
+    pqueue_free(&s->back);
+    bitboard_free(&s->rough);
+    pool_free(&s->nodes);
+    memset(s, 0, sizeof(*s));
+    return;
+}
+
+// starts a new search: every cell goes back to unreached by moving to the
+// next generation. Only when the counter wraps are the stamps cleared
+void search_reset(struct search *s)
+{
+    if (++s->gen == 0)
+    {
+        memset(s->stamp, 0, s->size * sizeof(uint32_t));
+        memset(s->rowstamp, 0, s->rough.height > 2 ? (s->rough.height - 2) * sizeof(uint32_t) : 0);
+        if (s->stampTo)
+            memset(s->stampTo, 0, s->size * sizeof(uint32_t));
+        if (s->closed)
+            memset(s->closed, 0, s->size * sizeof(uint32_t));
+        s->gen = 1;
+    }
+    return;
+}
+
 // a* pathfinding algorithm
-// one to one
-struct node *astar(int moveCost[], int start, int stop)
+// one to one, returns the path as a list from the workspace's pool
+struct node *astar(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop)
+{
+    if (astar_search(s, g, moveCost, start, stop))
+        return pathtolist(&s->nodes, s->cameFrom, stop);
+    return NULL; // failure to path find, should log this
+}
+
+// the search of astar, leaves the path in the workspace's cameFrom and
+// returns whether stop was reached
+// s is the workspace, reset here, so setup costs nothing per cell of the map
+bool astar_search(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop)
 { 
-    struct node *frontier;  // priority queue of cells to visit
-    int costTo[AREA];       // map of cumulative cost from start (origin) to key (hash of coords)
-    int cameFrom[AREA];     // the cell this cell was visited from originally
+    struct pqueue *frontier = &s->open; // priority queue of cells to visit
+    int *costTo = s->costTo;    // map of cumulative cost from start (origin) to key (hash of coords)
     int parent, child;      // stores keys, parent = visited key, child = key visitable from parent key (adjacent)
-    int i;                  // iterator
+    bool found = false;
+    int i, cost;            // iterator, cost to child through parent
+    bool inside;            // parent clear of the edges, its children are a step[] away
 
     // Initialization
-    pqueue_push(&frontier, start, 0); // priority queue starts with start
-    init(costTo, MAX_STEPS);             // initialize costTo map
-    costTo[start] = 0; // current tile (start) is 0 steps away
-    cameFrom[start] = INVALID; // so you know it's the start
+    search_reset(s);        // every cell unreached
+    pqueue_push(frontier, start, 0); // priority queue starts with start
+    search_visit(s, start, 0, INVALID); // current tile (start) is 0 steps away, INVALID so you know it's the start
 
-    while(frontier != NULL)
+    while(!pqueue_empty(frontier))
     {
-        parent = pqueue_pop(&frontier); // pop top of the queue
+        parent = pqueue_pop(frontier); // pop top of the queue
+        inside = inland(g, parent);
         // visit parent. For each adjacent cell (child), update costTo[child] if it can be lowered
         //      and if so, add to piority queue so key can be visited later
         for (i = 1; i < CARDINALS; ++i)
         { // ALLDIRS for all 8 dirs, CARDINALS for 4 cardinal directions only
-            child = offsetkey(parent, y(i), x(i));
+            child = inside ? parent + g->step[i] : offsetkey(g, parent, y(i), x(i));
             // if not out of bounds and cost from start to curr to tmp < recorded costTo[tmp]
             // updated costTo[tmp] to lower value and add to priority queue with priority = costTo[tmp]
             if (child == stop) // found goal?
             {
-            	costTo[child] = costTo[parent] + moveCost[child]; // update costTo map
-            	cameFrom[child] = parent;
-            	// report(cameFrom, stop); // for debugging
-                pqueue_purge(&frontier);   // purge the rest of the queue
-            	return pathtolist(cameFrom, stop);
+            	search_visit(s, child, costTo[parent] + moveCost[child], parent); // update costTo and cameFrom
+            	// report(g, s->cameFrom, stop); // for debugging
+                found = true;
+                pqueue_purge(frontier);   // drop the rest of the queue, empty for the next search
+                break;
             }
-            else if (isValid(child) && costTo[parent] + moveCost[child] < costTo[child])
+            else if (isValid(g, child) && moveCost[child] != COST_BLOCKED &&
+                     (cost = costTo[parent] + moveCost[child]) < search_cost(s, child))
             { 
-                costTo[child] = costTo[parent] + moveCost[child]; // update costTo map
-                cameFrom[child] = parent; // update cameFrom
-                pqueue_push(&frontier, child, costTo[child] + howfar(parent, child)); 
+                search_visit(s, child, cost, parent); // update costTo and cameFrom
+                pqueue_push(frontier, child, cost + 1); // howfar of a cardinal step
                 // push key to the queue, priority = costTo
-                // this means that a key could exist in the queue multiple times with different priorities
-                // by the time it visits the key for the last time, there will be no cells to visit.
-                // Can add a function that would seek & destroy prexisting keys in the queue, but would that
-                // really speed this up?
+                // if the key is already queued its priority is lowered instead
             }
         }
     }
-	return NULL; // failure to path find, should log this
+	return found;
 }
 
-// like a*, except flood fills to every legal tile in them map
-// one to many
-// needs to be modified to return the path map
-int *create_Djikstra_Map(int moveCost[], int start)
+// like a*, except flood fills to every legal tile in the map, over all 8
+// directions. Fills costTo with the cost from the nearest source and cameFrom
+// with the cell each was reached from, INVALID at sources and cells no source
+// reaches. Sources on blocked cells are skipped
+// many to many
+void create_Djikstra_Map(const struct grid *g, const uint8_t moveCost[], const int sources[], int n,
+                         int costTo[], int cameFrom[])
 { 
-    struct node *frontier;  // priority queue of cells to visit
-    int costTo[AREA];       // map of cumulative cost from start (origin) to key (hash of coords)
-    int cameFrom[AREA];     // the cell this cell was visited from originally
+    struct pqueue frontier; // priority queue of cells to visit
     int parent, child;      // stores keys, parent = visited key, child = key visitable from parent key (adjacent)
     int i;                  // iterators
-    int stop;
+    bool inside;            // parent clear of the edges, its children are a step[] away
 
     // Initialization
-    pqueue_push(&frontier, start, 0); // priority queue starts with start
-    init(costTo, MAX_STEPS);             // initialize costTo map
-    costTo[start] = 0; // current tile (start) is 0 steps away
-    cameFrom[start] = INVALID; // so you know it's the start
+    pqueue_init(&frontier, openset, g->size);
+    init(g, costTo, MAX_STEPS);          // initialize costTo map
+    init(g, cameFrom, INVALID);
+    for (i = 0; i < n; i++)
+        if (moveCost[sources[i]] != COST_BLOCKED)
+        {
+            costTo[sources[i]] = 0; // sources are 0 steps away
+            pqueue_push(&frontier, sources[i], 0); // priority queue starts with the sources
+        }
     // make djikstra steps map
-    while(frontier != NULL)
+    while(!pqueue_empty(&frontier))
     {
         parent = pqueue_pop(&frontier); // pop top of the queue
+        inside = inland(g, parent);
         // visit parent. For each adjacent cell (child), update costTo[child] if it can be lowered
         //      and if so, add to piority queue so key can be visited later
         for (i = 1; i < ALLDIRS; ++i)
         { // for each of the 8 directions - change i < 5 for cardinal only
-            child = offsetkey(parent, y(i), x(i));
+            child = inside ? parent + g->step[i] : offsetkey(g, parent, y(i), x(i));
 
             // if not out of bounds and cost from start to curr to tmp < recorded costTo[tmp]
             // updated costTo[tmp] to lower value and add to priority queue with priority = costTo[tmp]
-            if (isValid(child) && costTo[parent] + moveCost[child] < costTo[child])
+            if (isValid(g, child) && moveCost[child] != COST_BLOCKED &&
+                costTo[parent] + moveCost[child] < costTo[child])
             { 
                 costTo[child] = costTo[parent] + moveCost[child]; // update costTo map
                 cameFrom[child] = parent; // update cameFrom
                 pqueue_push(&frontier, child, costTo[child]); // push key to the queue, priority = costTo
-                // this means that a key could exist in the queue multiple times with different priorities
-                // by the time it visits the key for the last time, there will be no cells to visit.
-                // Can add a function that would seek & destroy prexisting keys in the queue, but would that
-                // really speed this up?
+                // if the key is already queued its priority is lowered instead
             }
         }
     }
-    fprintArray(costTo, 1);
-
+    pqueue_free(&frontier);
+    return;
 } 
 
 // writes path from array data into a linked list
-struct node *pathtolist(int cameFrom[], int stop)
+struct node *pathtolist(struct pool *p, int cameFrom[], int stop)
 {
-    int curr, i;
-    int tmp[AREA];
+    int curr;
     struct node *path = NULL;
 
-    memset(tmp, 0, sizeof(tmp));
-
-    // record path from stop to start into a temp array
-    for (curr = stop, i = 0; curr != INVALID; curr = cameFrom[curr], i++)
-        tmp[i] = curr;
-    
-    i--;
-    while (i >= 0)
-    { // write temp array values to list in reverse order (start to stop)
-        nodelist_append(&path, tmp[i]);
-        i--;
-    }
+    // walk from stop back to start, adding each key to the front of the list
+    // so the list reads start to stop
+    for (curr = stop; curr != INVALID; curr = cameFrom[curr])
+        nodelist_prepend(p, &path, curr);
     
     return path;
 }
 
 
 // record output (path) - for debugging
-void report(int cameFrom[], int stop)
+void report(const struct grid *g, int cameFrom[], int stop)
 {
-	int curr = stop, count = AREA;
-	int path[AREA];
-	memset(path, 0, sizeof(path));
+	int curr = stop, count = g->area;
+	int *path = newmap(g);
 	path[stop] = count;
 	while (cameFrom[curr] != INVALID)
 	{
 		path[curr] = --count;
 		curr = cameFrom[curr];
 	}
-	fprintArray(path, 1);
+	fprintArray(g, path, 1);
+	free(path);
     return;
 }
 
 // initialize map with a value so all cells are set to value
-void init(int *map, int val)
+void init(const struct grid *g, int *map, int val)
 {
     int i;
-    for (i = 0; i < AREA; ++i)
+    for (i = 0; i < g->size; ++i)
         map[i] = val;
     return;
 }
 
 // returns whether a key is valid
-bool isValid(int key)
+bool isValid(const struct grid *g, int key)
 {
-    return key > INVALID && key < AREA;
+    return key > INVALID && key < g->size;
 }
  
 // for a given iteration return the y coord
 int y(int i)
 {
-    switch(i) {
-        case 1: return 0;   // e
-        case 2: return 0;   // w
-        case 3: return 1;   // n
-        case 4: return -1;  // s
-        case 5: return 1;   // se
-        case 6: return -1;  // nw
-        case 7: return -1;  // ne
-        case 8: return 1;   // sw
-    }
+    return dy[i];
 }
- 
+
 // for a given iteration return the x coord
 int x(int i)
 {
-    switch(i) {
-        case 1: return 1;   // e
-        case 2: return -1;  // w
-        case 3: return 0;   // n
-        case 4: return 0;   // s
-        case 5: return 1;   // se
-        case 6: return -1;  // nw
-        case 7: return 1;   // ne
-        case 8: return -1;  // sw
-    }
-}
- 
-// Priority Queue functions
-
-// create a new linked list for supplied key and priority
-struct node *newNode(int key, int priority)
-{
-    struct node *tmp;
- 
-    tmp = malloc(sizeof(struct node));
-    tmp->key = key;
-    tmp->next = NULL;
-    tmp->priority = priority;
-    return tmp;
-}
-
-// push a new key to the priority queue - sorted MIN to MAX
-void pqueue_push(struct node **queue, int key, int priority)
-{
-    struct node *curr; // current member
-    struct node *tmp;
-
-    // if queue doesn't exist, start one
-    if (*queue == NULL) 
-    {
-        *queue = newNode(key, priority);
-    }
-    // else if need to insert at beginning of the queue
-    else if ((*queue)->priority > priority)
-    {
-        tmp = *queue;
-        *queue = newNode(key, priority);
-        (*queue)->next = tmp;
-    }
-    // else find where to insert
-    else
-    {
-        curr = *queue;
-        while (curr->next != NULL && priority >= (curr->next)->priority)
-                curr = curr->next; // find where to insert the node, sorted priority MIN to MAX
-        tmp = curr->next;
-        curr->next = newNode(key, priority);   // insert into queue
-        curr->next->next = tmp;
-    }
-    return;
-}
-
-// pop the priority queue
-int pqueue_pop(struct node **queue)
-{
-    
-    struct node *tmp;
-    int key;
- 
-    if (*queue == NULL)
-        return 0;
-    else
-    {
-        key = (*queue)->key;     // for the first in line - get their key
-        tmp = *queue;            // temporarily hold the ref to first in line
-        *queue = (*queue)->next; // 2nd item in list is now the 1st item
-        free(tmp);               // free the 1st in line
-        return key;              // 1st in line key is returned
-    }
-} 
-
-/*
-// frees remaining nodes in the queue w/ recursion
-void pqueue_purge_recur(struct node **queue)
-{
-    struct node *curr;
-    int i;
-
-    if (*queue == NULL) // if queue is empty, return
-        return;
-    else if ( (*queue)->next == NULL) // if only 1 member in queue, free ref and point to NULL
-    {
-        free(*queue);
-        *queue = NULL;
-    }
-    else // if more than 1 member in the queue
-    {
-        for (curr = *queue; curr->next->next != NULL; curr = curr->next)
-            ;
-        free(curr->next);
-        curr->next = NULL;
-    }
-    pqueue_purge(queue); // recur until *queue == NULL
-}*/
-
-// frees remaining nodes in the queue
-void pqueue_purge(struct node **queue)
-{
-    struct node *curr;
-    int i;
-
-    while (*queue) // while queue isn't empty
-    {
-        if ( (*queue)->next == NULL) // if only 1 member in queue, free ref and point to NULL
-        {
-            free(*queue);
-            *queue = NULL;
-        }
-        else // if more than 1 member in the queue
-        {
-            for (curr = *queue; curr->next->next != NULL; curr = curr->next)
-                ;   // find last member of queue
-            free(curr->next); // free last member
-            curr->next = NULL; // point 2nd to last member to null
-        }
-    }
-    return;
+    return dx[i];
 }
 
 // save a .csv file of the array
-void fprintArray(int array[], int step)
+void fprintArray(const struct grid *g, int array[], int step)
 {
     FILE *fp;
     char tmp1[20] = "step";
@@ -332,15 +311,15 @@ void fprintArray(int array[], int step)
     strcat(tmp1, tmp2); // concatenate "step" + step #
     strcat(tmp1, ".csv"); // add ".cvs" file extension to file name
     fp = fopen(tmp1, "w");    // create file w/ file name
-    for (y = 0; y < HEIGHT_MAX; y++)  // write the array values in csv format
+    for (y = 0; y < g->height; y++)  // write the array values in csv format
     {
-        for (x = 0; x < WIDTH_MAX; x++)
+        for (x = 0; x < g->width; x++)
         {
-            fprintf(fp, "%d", array[hash(y, x)]);
-            if (x < WIDTH_MAX - 1)
+            fprintf(fp, "%d", array[hash(g, y, x)]);
+            if (x < g->width - 1)
                 fprintf(fp,",");    
         }
-        if (y < HEIGHT_MAX - 1) 
+        if (y < g->height - 1) 
             fprintf(fp, "\n"); // write for all but the final line 
     }
     fclose(fp);
@@ -0,0 +1,296 @@
+/******************************************************************************
+
+Corridor planning
+
+Decides which pairs of room links get a corridor. The links are put in a
+uniform grid of buckets about two links each, and every link is offered the
+links of the buckets around it, the ring widening until it has its
+CANDIDATES nearest. Kruskal's algorithm takes a minimum spanning tree of that sparse
+graph, with a union-find over the links. Should the graph come out in
+pieces (clusters of rooms far apart), every piece is offered the nearest
+link outside it and Kruskal runs again, until everything is one tree (Boruvka's step).
+
+Pairs are returned shortest first, so the long corridors are searched last,
+when there are the most corridors already carved to run along. Extra pairs
+that close loops can be added from the candidates the tree didn't use.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+#define CANDIDATES  4   // neighbours each link is offered at least
+#define PER_BUCKET  2   // links per bucket the index aims for
+
+// one candidate corridor
+struct edge {
+    int a, b;           // indices of the links, a < b
+    int len;            // manhattan distance between them
+    bool tree;          // taken by the spanning tree
+};
+
+// links bucketed by position
+struct linkindex {
+    const struct grid *g;
+    const int *links;
+    int n;
+    int size;           // cells per bucket side
+    int rows, cols;     // buckets
+    int *head;          // first link in each bucket, INVALID if empty
+    int *next;          // next link in the same bucket
+};
+
+// the nearest links to one link found so far
+struct nearest {
+    int n, keep;        // found, wanted
+    int j[CANDIDATES];  // links, nearest first
+    int len[CANDIDATES]; // and their distances
+};
+
+/* #################### FUNCTIONS ############################### */
+void index_build(struct linkindex *x, const struct grid *g, const int links[], int n); // buckets the links
+void index_free(struct linkindex *x); // frees the buckets
+int index_offer(const struct linkindex *x, int i, int keep, const int comp[], int limit,
+                struct edge **e, int *ne, int *cap); // offers link i its nearest links
+void index_ring(const struct linkindex *x, int i, int r, const int comp[], struct nearest *k); // looks r buckets away
+void edge_add(struct edge **e, int *ne, int *cap, int a, int b, int len); // appends a candidate
+int edgecmp(const void *a, const void *b); // shortest first, then by links
+int uf_find(int parent[], int i); // root of i's set
+bool uf_union(int parent[], int size[], int a, int b); // joins two sets, false if already one
+/* ############################################################## */
+
+// writes the pairs of links to connect into pairs[], two indices into links
+// per pair, shortest first, and returns how many pairs. Besides the tree,
+// loops pairs picked with rng from the candidates the tree left over close
+// loops. pairs must hold 2 * (n - 1 + loops) ints
+int plan_links(const struct grid *g, struct rng *rng, const int links[], int n, int loops, int pairs[])
+{
+    struct linkindex x;
+    struct edge *e = NULL, tmp;
+    int ne = 0, cap = 0, pieces = n;
+    int *parent = malloc(n * sizeof(int)), *size = malloc(n * sizeof(int)), *comp = malloc(n * sizeof(int));
+    int *best = malloc(n * sizeof(int)); // nearest link outside each piece found so far
+    int i, j, len, ntree, spare;
+
+    index_build(&x, g, links, n);
+    for (i = 0; i < n; i++)
+    { // candidates: the nearest few links of each
+        parent[i] = i;
+        size[i] = 1;
+        index_offer(&x, i, CANDIDATES, NULL, MAX_STEPS, &e, &ne, &cap);
+    }
+    for (;;)
+    {
+        qsort(e, ne, sizeof(struct edge), edgecmp);
+        for (i = j = 0; i < ne; i++)
+        { // both ends may have offered the same edge
+            if (j > 0 && e[i].a == e[j - 1].a && e[i].b == e[j - 1].b)
+                e[j - 1].tree |= e[i].tree;
+            else
+                e[j++] = e[i];
+        }
+        ne = j;
+        for (i = 0; i < ne && pieces > 1; i++)
+            if (uf_union(parent, size, e[i].a, e[i].b))
+            {
+                e[i].tree = true;
+                pieces--;
+            }
+        if (pieces <= 1)
+            break;
+        // still in pieces: offer every link the nearest link of another
+        // piece, if nearer than the piece has found yet, then go again.
+        // Union-find keeps the tree built so far
+        for (i = 0; i < n; i++)
+        {
+            comp[i] = uf_find(parent, i);
+            best[i] = MAX_STEPS;
+        }
+        for (i = 0; i < n; i++)
+            if ((len = index_offer(&x, i, 1, comp, best[comp[i]], &e, &ne, &cap)) < best[comp[i]])
+                best[comp[i]] = len;
+    }
+
+    // tree edges to the front, then a random pick of the rest closes loops
+    for (i = j = 0; i < ne; i++)
+        if (e[i].tree)
+        {
+            tmp = e[j];
+            e[j++] = e[i];
+            e[i] = tmp;
+        }
+    ntree = j;
+    spare = ne - ntree;
+    for (i = 0; i < loops && i < spare; i++)
+    { // partial shuffle of the spare candidates
+        j = ntree + i + rng_below(rng, spare - i);
+        tmp = e[ntree + i];
+        e[ntree + i] = e[j];
+        e[j] = tmp;
+    }
+    ntree += i;
+    qsort(e, ntree, sizeof(struct edge), edgecmp); // shortest first
+    for (i = 0; i < ntree; i++)
+    {
+        pairs[i * 2] = e[i].a;
+        pairs[i * 2 + 1] = e[i].b;
+    }
+    free(e);
+    free(parent);
+    free(size);
+    free(comp);
+    free(best);
+    index_free(&x);
+    return ntree;
+}
+
+// buckets the links in a uniform grid sized for about PER_BUCKET links each
+void index_build(struct linkindex *x, const struct grid *g, const int links[], int n)
+{
+    int i, b;
+
+    x->g = g;
+    x->links = links;
+    x->n = n;
+    x->size = 1;
+    while (n > 0 && x->size < g->height + g->width && x->size * x->size * n < g->area * PER_BUCKET)
+        x->size *= 2; // bucket area about area / n * PER_BUCKET
+    x->rows = (g->height + x->size - 1) / x->size;
+    x->cols = (g->width + x->size - 1) / x->size;
+    x->head = malloc(x->rows * x->cols * sizeof(int));
+    x->next = malloc((n ? n : 1) * sizeof(int));
+    for (b = 0; b < x->rows * x->cols; b++)
+        x->head[b] = INVALID;
+    for (i = n - 1; i >= 0; i--)
+    { // pushed in reverse so each bucket lists its links in order
+        b = gety(g, links[i]) / x->size * x->cols + getx(g, links[i]) / x->size;
+        x->next[i] = x->head[b];
+        x->head[b] = i;
+    }
+    return;
+}
+
+// frees the buckets
+void index_free(struct linkindex *x)
+{
+    free(x->head);
+    free(x->next);
+    return;
+}
+
+// offers link i its keep nearest links as candidate edges, nearer than
+// limit. Rings of buckets are searched outwards until no link further out
+// can be nearer than the ones found: a link r rings away is more than
+// (r - 1) * size cells away. With comp only links of another piece count.
+// Returns the distance to the nearest, MAX_STEPS if there is none
+int index_offer(const struct linkindex *x, int i, int keep, const int comp[], int limit,
+                struct edge **e, int *ne, int *cap)
+{
+    struct nearest k;
+    int reach = x->rows > x->cols ? x->rows : x->cols; // rings past this cover the whole map
+    int r, lo;
+
+    k.n = 0;
+    k.keep = keep;
+    for (r = 0; r <= reach; r++)
+    {
+        lo = (r - 1) * x->size;
+        if (lo >= limit || (k.n == keep && lo >= k.len[k.n - 1]))
+            break;
+        index_ring(x, i, r, comp, &k);
+    }
+    for (r = 0; r < k.n; r++)
+        edge_add(e, ne, cap, i, k.j[r], k.len[r]);
+    return k.n ? k.len[0] : MAX_STEPS;
+}
+
+// looks at the links in the buckets exactly r away from link i's own (the
+// square ring), keeping the nearest in k
+void index_ring(const struct linkindex *x, int i, int r, const int comp[], struct nearest *k)
+{
+    const struct grid *g = x->g;
+    int by = gety(g, x->links[i]) / x->size, bx = getx(g, x->links[i]) / x->size;
+    int row, col, j, len, at;
+
+    for (row = by - r; row <= by + r; row++)
+        for (col = bx - r; col <= bx + r; col += (row == by - r || row == by + r) ? 1 : 2 * r)
+        {
+            if (row >= 0 && row < x->rows && col >= 0 && col < x->cols)
+                for (j = x->head[row * x->cols + col]; j != INVALID; j = x->next[j])
+                {
+                    if (j == i || (comp && comp[j] == comp[i]))
+                        continue;
+                    len = howfar(g, x->links[i], x->links[j]);
+                    if (k->n == k->keep && len >= k->len[k->n - 1])
+                        continue; // no nearer than the furthest kept
+                    if (k->n < k->keep)
+                        k->n++;
+                    for (at = k->n - 1; at > 0 && k->len[at - 1] > len; at--)
+                    { // insertion, nearest first, equal distances in bucket order
+                        k->len[at] = k->len[at - 1];
+                        k->j[at] = k->j[at - 1];
+                    }
+                    k->len[at] = len;
+                    k->j[at] = j;
+                }
+            if (r == 0)
+                break; // the ring is the one bucket
+        }
+    return;
+}
+
+// appends a candidate edge between links a and b
+void edge_add(struct edge **e, int *ne, int *cap, int a, int b, int len)
+{
+    if (*ne == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 64;
+        *e = realloc(*e, *cap * sizeof(struct edge));
+    }
+    (*e)[*ne].a = a < b ? a : b;
+    (*e)[*ne].b = a < b ? b : a;
+    (*e)[*ne].len = len;
+    (*e)[(*ne)++].tree = false;
+    return;
+}
+
+// qsort order for edges: shortest first, ties by their links so the order
+// never depends on the sort
+int edgecmp(const void *a, const void *b)
+{
+    const struct edge *x = a, *y = b;
+
+    if (x->len != y->len)
+        return x->len - y->len;
+    if (x->a != y->a)
+        return x->a - y->a;
+    return x->b - y->b;
+}
+
+// returns the root of i's set, halving the path on the way
+int uf_find(int parent[], int i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+// joins the sets of a and b, the smaller under the larger. Returns false if
+// they were already one set
+bool uf_union(int parent[], int size[], int a, int b)
+{
+    a = uf_find(parent, a);
+    b = uf_find(parent, b);
+    if (a == b)
+        return false;
+    if (size[a] < size[b])
+    {
+        parent[a] = b;
+        size[b] += size[a];
+    }
+    else
+    {
+        parent[b] = a;
+        size[a] += size[b];
+    }
+    return true;
+}
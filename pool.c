@@ -0,0 +1,93 @@
+/******************************************************************************
+
+Pools
+
+Fixed size items carved out of slabs, for the linked lists: the rooms of a
+level and the nodes of a path. Taking an item is a pointer bump, giving one
+back pushes it on a list of spares that are handed out first. A reset takes
+back every item at once and keeps the slabs for the next level, so a
+dungeon stops calling malloc once it has generated its first few levels.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+// a block of items, slabs are chained oldest first
+struct slab {
+    struct slab *next;
+    max_align_t items[]; // per * size bytes
+};
+
+// starts an empty pool of items of size bytes, per items to a slab
+void pool_init(struct pool *p, size_t size, int per)
+{
+    memset(p, 0, sizeof(*p));
+    p->size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+    p->per = per > 0 ? per : 1;
+    return;
+}
+
+// frees every slab, and with them every item handed out
+void pool_free(struct pool *p)
+{
+    struct slab *s, *next;
+
+    for (s = p->slabs; s; s = next)
+    {
+        next = s->next;
+        free(s);
+    }
+    p->slabs = p->cur = NULL;
+    p->used = 0;
+    p->spare = NULL;
+    return;
+}
+
+// returns an item, NULL if out of memory. Spares go first, then the current
+// slab, then the next slab, kept from before a reset or allocated
+void *pool_alloc(struct pool *p)
+{
+    struct slab *s;
+    void *item;
+
+    if (p->spare)
+    {
+        item = p->spare;
+        p->spare = *(void **) item; // a spare holds the link to the next
+        return item;
+    }
+    if (!p->cur || p->used == p->per)
+    {
+        s = p->cur ? p->cur->next : p->slabs;
+        if (!s)
+        {
+            if (!(s = malloc(sizeof(struct slab) + p->per * p->size)))
+                return NULL;
+            s->next = NULL;
+            if (p->cur)
+                p->cur->next = s;
+            else
+                p->slabs = s;
+        }
+        p->cur = s;
+        p->used = 0;
+    }
+    return (char *) p->cur->items + p->used++ * p->size;
+}
+
+// gives one item back to be handed out again
+void pool_release(struct pool *p, void *item)
+{
+    *(void **) item = p->spare;
+    p->spare = item;
+    return;
+}
+
+// takes back every item handed out, keeping the slabs
+void pool_reset(struct pool *p)
+{
+    p->cur = NULL;
+    p->used = 0;
+    p->spare = NULL;
+    return;
+}
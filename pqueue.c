@@ -0,0 +1,338 @@
+/******************************************************************************
+
+Priority queues (open sets) for the pathfinding algorithms
+
+Two backends share one interface:
+	PQ_HEAP   - array backed binary min heap
+	PQ_BUCKET - Dial's bucket queue, a ring of FIFO buckets indexed by priority
+Both support decrease-key, so a key is never in the queue more than once.
+Keys must be in the range 0 .. cap - 1, priorities must not be negative.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+/* #################### FUNCTIONS ############################### */
+// binary heap backend
+void heap_push(struct pqueue *q, int key, int priority); // insert a key or lower its priority
+int heap_pop(struct pqueue *q); // remove the key with the lowest priority
+void heap_siftup(struct pqueue *q, int slot); // move a slot towards the root until ordered
+void heap_siftdown(struct pqueue *q, int slot); // move a slot towards the leaves until ordered
+void heap_place(struct pqueue *q, int slot, int key); // put key in slot and record its position
+// bucket queue backend
+void bucket_push(struct pqueue *q, int key, int priority); // insert a key or lower its priority
+int bucket_pop(struct pqueue *q); // remove the key with the lowest priority
+void bucket_link(struct pqueue *q, int key); // add key to the tail of its bucket
+void bucket_unlink(struct pqueue *q, int key); // remove key from its bucket
+void bucket_grow(struct pqueue *q, int span); // resize the bucket ring to hold span priorities
+/* ############################################################## */
+
+// initial number of buckets, grown as needed. Move costs are small so the
+// spread of priorities in the open set rarely exceeds this
+#define BUCKETS_MIN 	16
+
+// creates an empty queue of the given type for keys 0 .. cap - 1
+bool pqueue_init(struct pqueue *q, int type, int cap)
+{
+    int i;
+
+    memset(q, 0, sizeof(*q));
+    q->type = type;
+    q->cap = cap;
+    q->prio = malloc(cap * sizeof(int));
+    q->pos = malloc(cap * sizeof(int));
+    if (type == PQ_HEAP)
+        q->heap = malloc(cap * sizeof(int));
+    else
+    {
+        q->next = malloc(cap * sizeof(int));
+        q->prev = malloc(cap * sizeof(int));
+        q->nbuckets = BUCKETS_MIN;
+        q->bucket = malloc(q->nbuckets * sizeof(int));
+    }
+    if (!q->prio || !q->pos || (type == PQ_HEAP ? !q->heap : !q->next || !q->prev || !q->bucket))
+    {
+        pqueue_free(q);
+        return FAILURE;
+    }
+    for (i = 0; i < cap; i++)
+        q->pos[i] = INVALID; // nothing is queued
+    for (i = 0; i < q->nbuckets; i++)
+        q->bucket[i] = INVALID; // every bucket is empty
+    return SUCCESS;
+}
+
+// frees the queue's buffers
+void pqueue_free(struct pqueue *q)
+{
+    free(q->prio);
+    free(q->pos);
+    free(q->heap);
+    free(q->next);
+    free(q->prev);
+    free(q->bucket);
+    memset(q, 0, sizeof(*q));
+    return;
+}
+
+// push a key to the queue. If the key is already queued its priority is
+// lowered instead, a higher priority than the queued one is ignored
+void pqueue_push(struct pqueue *q, int key, int priority)
+{
+    if (q->pos[key] != INVALID && q->prio[key] <= priority)
+        return; // already queued at least as early
+    if (q->type == PQ_HEAP)
+        heap_push(q, key, priority);
+    else
+        bucket_push(q, key, priority);
+    return;
+}
+
+// pop the key with the lowest priority, INVALID if the queue is empty
+int pqueue_pop(struct pqueue *q)
+{
+    if (q->size == 0)
+        return INVALID;
+    else if (q->type == PQ_HEAP)
+        return heap_pop(q);
+    else
+        return bucket_pop(q);
+}
+
+// returns whether the queue is empty
+bool pqueue_empty(struct pqueue *q)
+{
+    return q->size == 0;
+}
+
+// returns whether a key is currently queued
+bool pqueue_contains(struct pqueue *q, int key)
+{
+    return q->pos[key] != INVALID;
+}
+
+// removes a key from the queue if it is queued
+void pqueue_remove(struct pqueue *q, int key)
+{
+    int slot = q->pos[key], last;
+
+    if (slot == INVALID)
+        return;
+    if (q->type == PQ_BUCKET)
+        bucket_unlink(q, key);
+    else
+    {
+        q->pos[key] = INVALID;
+        if (slot < q->size - 1)
+        { // the last key fills the hole and moves whichever way it has to
+            last = q->heap[--q->size];
+            heap_place(q, slot, last);
+            heap_siftup(q, slot);
+            if (q->pos[last] == slot) // didn't move up, may have to sink
+                heap_siftdown(q, slot);
+            return;
+        }
+    }
+    q->size--;
+    return;
+}
+
+// removes all remaining keys, in proportion to the number of keys queued
+void pqueue_purge(struct pqueue *q)
+{
+    int i;
+
+    if (q->type == PQ_HEAP)
+    { // the heap is just its slots, no order to keep while emptying it
+        for (i = 0; i < q->size; i++)
+            q->pos[q->heap[i]] = INVALID;
+        q->size = 0;
+    }
+    while (q->size > 0)
+        pqueue_pop(q);
+    return;
+}
+
+// Binary heap backend
+
+// insert a key or lower its priority
+void heap_push(struct pqueue *q, int key, int priority)
+{
+    q->prio[key] = priority;
+    if (q->pos[key] == INVALID) // new key goes at the bottom of the heap
+        heap_place(q, q->size++, key);
+    heap_siftup(q, q->pos[key]); // a lower priority can only move up
+    return;
+}
+
+// remove the key with the lowest priority
+int heap_pop(struct pqueue *q)
+{
+    int key = q->heap[0];
+
+    q->pos[key] = INVALID;
+    if (--q->size > 0)
+    { // move the last key to the root and let it sink
+        heap_place(q, 0, q->heap[q->size]);
+        heap_siftdown(q, 0);
+    }
+    return key;
+}
+
+// move a slot towards the root until its parent has a lower priority
+void heap_siftup(struct pqueue *q, int slot)
+{
+    int key = q->heap[slot];
+    int parent;
+
+    while (slot > 0)
+    {
+        parent = (slot - 1) / 2;
+        if (q->prio[q->heap[parent]] <= q->prio[key])
+            break;
+        heap_place(q, slot, q->heap[parent]); // pull parent down
+        slot = parent;
+    }
+    heap_place(q, slot, key);
+    return;
+}
+
+// move a slot towards the leaves until both children have a higher priority
+void heap_siftdown(struct pqueue *q, int slot)
+{
+    int key = q->heap[slot];
+    int child;
+
+    while ((child = slot * 2 + 1) < q->size)
+    {
+        if (child + 1 < q->size && q->prio[q->heap[child + 1]] < q->prio[q->heap[child]])
+            child++; // pick the lower of the two children
+        if (q->prio[key] <= q->prio[q->heap[child]])
+            break;
+        heap_place(q, slot, q->heap[child]); // pull child up
+        slot = child;
+    }
+    heap_place(q, slot, key);
+    return;
+}
+
+// put key in slot and record its position
+void heap_place(struct pqueue *q, int slot, int key)
+{
+    q->heap[slot] = key;
+    q->pos[key] = slot;
+    return;
+}
+
+// Bucket queue backend
+// Every queued priority lies in [lo, lo + nbuckets), so a priority maps to
+// bucket (priority % nbuckets) without collisions. Each bucket is a circular
+// doubly linked list threaded through next[] and prev[]: bucket[b] is the
+// head and prev[head] the tail, which keeps equal priorities first in first out.
+
+// insert a key or lower its priority
+void bucket_push(struct pqueue *q, int key, int priority)
+{
+    int lo = q->lo, hi = q->hi;
+
+    if (q->pos[key] != INVALID)
+    { // decrease-key: take it out of its old bucket first
+        bucket_unlink(q, key);
+        q->size--;
+    }
+    if (q->size == 0)
+        lo = hi = priority; // the ring can start anywhere
+    else if (priority < lo)
+        lo = priority;
+    else if (priority > hi)
+        hi = priority;
+    if (hi - lo >= q->nbuckets)
+        bucket_grow(q, hi - lo + 1);
+    q->lo = lo;
+    q->hi = hi;
+    q->prio[key] = priority;
+    bucket_link(q, key);
+    q->size++;
+    return;
+}
+
+// remove the key with the lowest priority
+int bucket_pop(struct pqueue *q)
+{
+    int mask = q->nbuckets - 1;
+    int key;
+
+    while (q->bucket[q->lo & mask] == INVALID)
+        q->lo++; // skip empty buckets, bounded by the ring size
+    key = q->bucket[q->lo & mask];
+    bucket_unlink(q, key);
+    q->size--;
+    return key;
+}
+
+// add key to the tail of the bucket for its priority
+void bucket_link(struct pqueue *q, int key)
+{
+    int b = q->prio[key] & (q->nbuckets - 1);
+    int head = q->bucket[b];
+
+    q->pos[key] = b;
+    if (head == INVALID)
+    { // first key in the bucket links to itself
+        q->bucket[b] = key;
+        q->next[key] = q->prev[key] = key;
+    }
+    else
+    { // insert between the tail and the head
+        q->next[key] = head;
+        q->prev[key] = q->prev[head];
+        q->next[q->prev[head]] = key;
+        q->prev[head] = key;
+    }
+    return;
+}
+
+// remove key from its bucket
+void bucket_unlink(struct pqueue *q, int key)
+{
+    int b = q->pos[key];
+
+    if (q->next[key] == key) // only key in the bucket
+        q->bucket[b] = INVALID;
+    else
+    {
+        q->next[q->prev[key]] = q->next[key];
+        q->prev[q->next[key]] = q->prev[key];
+        if (q->bucket[b] == key)
+            q->bucket[b] = q->next[key];
+    }
+    q->pos[key] = INVALID;
+    return;
+}
+
+// resize the ring so span consecutive priorities fit, re-bucketing every key
+void bucket_grow(struct pqueue *q, int span)
+{
+    int *old = q->bucket;
+    int oldn = q->nbuckets;
+    int i, key, nxt, head;
+
+    while (q->nbuckets < span)
+        q->nbuckets *= 2; // stays a power of two so % is a mask
+    q->bucket = malloc(q->nbuckets * sizeof(int));
+    for (i = 0; i < q->nbuckets; i++)
+        q->bucket[i] = INVALID;
+    for (i = 0; i < oldn; i++)
+    { // walk each old bucket head to tail, keeping FIFO order
+        if ((head = old[i]) == INVALID)
+            continue;
+        key = head;
+        do {
+            nxt = q->next[key];
+            bucket_link(q, key);
+            key = nxt;
+        } while (key != head);
+    }
+    free(old);
+    return;
+}
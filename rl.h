@@ -2,17 +2,50 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <ctype.h>
 #include <time.h>
-#include <ncurses.h>
+#include <limits.h>
+#include <unistd.h>
 
-#define HEIGHT_MAX      20	// map height
-#define WIDTH_MAX       80	// map width
-#define AREA      	  	HEIGHT_MAX * WIDTH_MAX // map area
+#define HEIGHT_DEFAULT  20	// map height unless another is requested
+#define WIDTH_DEFAULT   80	// map width unless another is requested
+#define MAP_MIN			16	// smallest height or width that fits the largest room
+#define MAP_MAX			4096 // largest height or width
 #define INVALID     	-1
 #define SUCCESS			true
 #define FAILURE			false
-#define MAX_STEPS		999
+#define MAX_STEPS		INT_MAX // cost of a cell that hasn't been reached
+#define COST_BLOCKED	UINT8_MAX // move cost of a cell the pathfinders can't enter
+#define CARDINALS 		5	// n, s, e, w
+#define ALLDIRS			9 	// n, s, e, w, ne, nw, se, sw
+
+// tile flags, one byte per cell in a dungeon's flag plane
+#define TF_WALK			0x01 // creatures can stand on the tile
+
+// tile types, a map stores one per cell in a byte
+enum { STONE, GRANITE, ROOM, BORDER, CORNER, CORRIDOR, O_DOOR, C_DOOR, 
+		IRONBARS, WATER, LAVA, LINK, SPACER, UPSTAIRS, DOWNSTAIRS};
+
+// cell layouts, how a grid turns coordinates into keys
+enum { LAYOUT_ROWS, LAYOUT_TILES };
+#define TILE_SHIFT		3	// LAYOUT_TILES stores 8x8 blocks of cells contiguously
+#define TILE_SIZE		(1 << TILE_SHIFT)
+
+// map descriptor, every map buffer holds one entry per key and is indexed by
+// keys made from its grid. Tiles, costs and flags are byte planes, search
+// state such as costTo is int
+struct grid {
+	int height, width;  // map dimensions
+	int area;           // number of cells, height * width
+	int size;           // number of keys, the area plus any padding of the layout
+	int layout;         // LAYOUT_ROWS or LAYOUT_TILES
+	int pitch;          // keys per row, or tiles per row of tiles
+	uint64_t magic;     // reciprocal of pitch, so keys are split without dividing
+	int step[ALLDIRS];  // key delta to the neighbour in each direction, for keys inland() holds for
+};
 
 struct node {
     int key;
@@ -25,28 +58,394 @@ struct room {
 	struct room *next;
 };
 
+// a path as one run of keys, start to stop, in a buffer the caller owns, see path.c
+struct path {
+	int *keys;              // start to stop
+	int cap;                // keys the buffer holds
+	int len;                // keys in the path, 0 if there is none, past cap if it didn't fit
+	int cost;               // move cost from start to stop
+};
+
+// fixed size items carved from slabs and taken back all at once, see pool.c
+struct pool {
+	size_t size;            // bytes per item, rounded up to keep items aligned
+	int per;                // items per slab
+	int used;               // items handed out of the current slab
+	struct slab *slabs;     // every slab, oldest first
+	struct slab *cur;       // slab items are carved from, NULL before the first
+	void *spare;            // items given back, handed out first
+};
+
+// rooms in the order they were added, from a pool of their own
+struct roomlist {
+	struct room *head, *tail;
+	int n;
+	struct pool pool;
+};
+
+// one bit per cell, rows of 64 bit words, see bitboard.c
+struct bitboard {
+	int height, width;
+	int words;              // words per row
+	uint64_t *bits;
+};
+
+// random number generator state, see rng.c
+struct rng {
+	uint64_t s[4];
+};
+
+// tentative writes to a map that can be kept or undone. Every write is
+// logged with the value it replaced, so undoing costs as much as the writes
+struct draft {
+	uint8_t *map;           // map the writes go to
+	int *keys;              // cells written since the last commit, in order
+	uint8_t *old;           // value each cell had before its write
+	int n, cap;             // writes logged, room in the log
+};
+
+
+// open set backends for the pathfinders
+enum { PQ_HEAP, PQ_BUCKET };
+// algorithms findpath can use
+enum { PF_ASTAR, PF_JPS };
+// ways connect_rooms picks the rooms to join
+enum { PLAN_CHAIN, PLAN_MST, PLAN_LOOPS };
+// ways generate places the rooms
+enum { PLACE_SCATTER, PLACE_PACKED };
+// ways connect_rooms digs the corridors it planned
+enum { CORR_SERIAL, CORR_BATCH, CORR_SPECULATE };
+// engines that build distance maps
+enum { DM_FLOOD, DM_SWEEP };
+
+struct pqueue {
+	int type;           // PQ_HEAP or PQ_BUCKET
+	int size;           // number of keys queued
+	int cap;            // keys are in the range 0 .. cap - 1
+	int *prio;          // priority of each queued key
+	int *pos;           // heap slot or bucket of each key, INVALID if not queued
+	int *heap;          // PQ_HEAP: binary min heap of keys
+	int *next, *prev;   // PQ_BUCKET: links between keys in the same bucket
+	int *bucket;        // PQ_BUCKET: first key in each bucket, INVALID if empty
+	int nbuckets;       // PQ_BUCKET: size of the bucket ring, a power of two
+	int lo, hi;         // PQ_BUCKET: bounds of the priorities queued
+};
+
+// reusable state of the pathfinders, one per thread. costTo and cameFrom of
+// a cell only count when its stamp is the current generation, so starting a
+// search is a counter bump instead of clearing the whole map
+struct search {
+	int size;               // keys of the grid it was made for
+	int *costTo;            // cumulative cost from start to each key
+	int *cameFrom;          // the cell each key was reached from
+	uint32_t *stamp;        // generation that last wrote each key
+	uint32_t gen;           // current generation
+	struct pqueue open;     // open set, empty between searches
+	struct bitboard rough;  // jps: cells that aren't open ground, a row at a time
+	uint32_t *rowstamp;     // jps: generation that filled each row of rough
+	uint64_t *near;         // jps: scratch row
+	struct pool nodes;      // nodes of the paths returned, given back with nodelist_purge
+	uint32_t *closed;       // bounded searches: generation that expanded each key, allocated on first use
+	int *costFrom;          // bidirectional: cost from each key to the stop, allocated on first use
+	int *cameTo;            // bidirectional: the cell towards the stop each key was reached from
+	uint32_t *stampTo;      // bidirectional: generation that last wrote each key backwards
+	struct pqueue back;     // bidirectional: backward open set, empty between searches
+};
+
+// search_bounded modes, and how a bounded search ended, see bounded.c
+enum { BS_ASTAR, BS_WEIGHTED, BS_BIDIR, BS_ANYTIME };
+enum { BS_FOUND, BS_PARTIAL, BS_UNREACHABLE };
+
+// a query of a many to many batch, and where its path went, see multipath.c
+struct query {
+	int start, stop;
+	int at;                 // out: the path's first key in the batch's keys, INVALID if there is none
+	int len;                // out: keys of the path, 0 if none
+	int cost;               // out: move cost of the path
+};
+
+// answers batches of path queries over one cost plane
+struct multipath {
+	struct grid grid;
+	int nworkers;
+	struct search *ws;      // a workspace per worker, made on first use
+	struct path *part;      // per worker: the paths it found, one after another
+	int *keys;              // every path of the last batch, in query order
+	int len, cap;
+	int *order, *owner;     // queries in group order, the worker that answered each
+	int ordercap;
+};
+
+// limits of a bounded search, and what it spent
+struct budget {
+	int mode;               // BS_ASTAR, BS_WEIGHTED, BS_BIDIR or BS_ANYTIME
+	int weight;             // weighted and anytime: percent the distance to the stop counts, 100 or more
+	long expansions;        // most cells to expand, 0 for no limit
+	long usec;              // most microseconds to search, 0 for no limit
+	long expanded;          // out: cells expanded
+	int bound;              // out, BS_FOUND: the path costs at most bound percent of the cheapest
+};
+
+// cost of the cheapest path to every cell from the nearest of a set of
+// sources, see dmap.c
+struct dmap {
+	struct grid grid;       // dimensions of the map it was built over
+	int *dist;              // cost from the nearest source, MAX_STEPS if unreachable
+	int *from;              // next cell towards that source, INVALID at sources and unreachable cells
+	int *sources;           // source keys, sorted, no repeats
+	int nsources;
+	uint64_t version;       // version of the cost plane it was built from
+	int refs;               // owners, freed when the last one releases it
+	int *rhs;               // repairs: cost each cell's neighbours offer, made on the first repair
+	struct pqueue open;     // repairs: cells whose dist and rhs disagree, empty between repairs
+};
+
+// recently built distance maps, handed out again while version and sources match
+struct dmapcache {
+	struct dmap **maps;     // most recently used first
+	int n, cap;
+	long hits, misses;
+};
+
+// hierarchical pathfinding over chunks of the map, see hpa.c
+struct hpa {
+	struct grid grid;
+	int rows, cols;         // chunks
+	struct chunk *chunks;   // abstract nodes and the costs between them, by chunk
+	uint64_t version;       // version of the cost plane the chunks were worked out from
+	int *dist, *from;       // searches inside one chunk
+	struct pqueue open;     // their open set, empty between searches
+	int *startcost, *stopcost; // a query: cost between the start or stop and each node of its chunk
+	int startcap, stopcap;
+	int *chain, chaincap;   // a query: the abstract path
+	long builds;            // chunks worked out so far
+};
+
+// level packs, see pack.c. Tile encodings of a level record
+enum { PACK_RAW, PACK_RLE };
+#define PACK_VERSION	1
+
+// one level in a pack, followed by nrooms packrooms, npoints packpoints and
+// ntiles bytes of tiles
+struct packlevel {
+	uint32_t size;          // bytes of the record, a multiple of 8
+	uint16_t height, width;
+	uint64_t seed, level;
+	uint32_t nrooms, npoints;
+	uint32_t ntiles;        // bytes of tiles
+	uint8_t encoding;       // PACK_RAW or PACK_RLE
+	uint8_t reserved[3];
+};
+
+struct packroom {
+	uint16_t y, x, height, width; // the room inside its walls
+};
+
+// a link or a stair
+struct packpoint {
+	uint16_t y, x;
+	uint8_t tile;           // LINK, UPSTAIRS or DOWNSTAIRS
+	uint8_t reserved[3];
+};
+
+// a pack mapped into memory
+struct pack {
+	const uint8_t *base;
+	size_t size;
+	uint64_t count;         // levels
+	const uint64_t *index;  // offset of each level's record
+};
+
+// a generated level and the scratch buffers used to make it
+struct dungeon {
+	struct grid grid;       // map dimensions
+	uint8_t *map;           // finished map, one tile type per cell
+	uint8_t *cost;          // movement cost of each cell, see get_move_cost
+	uint8_t *flags;         // TF_ flags of each cell, derived once the map is done
+	struct draft draft;     // tentative writes to the map, the "what if?"
+	struct bitboard occ;    // cells covered by placed rooms, borders and spacers
+	struct roomlist rooms;  // rooms placed on the map
+	int *anchors;           // PLACE_PACKED: room corners still on offer, allocated on first use
+	uint64_t seed, level;   // the level is stream level of seed
+	uint64_t version;       // bumped whenever the map (and so the cost plane) changes
+	struct rng rng;         // generator for this level
+	struct search search;   // pathfinding workspace for the corridors
+	struct path corridor;   // keys of the corridor being dug, grown as needed
+	int *links, nlinks;     // the cell on each room's wall its corridors start from
+	int linkcap;            // links the buffer holds
+	struct multipath *multi; // CORR_BATCH: corridor searches, allocated on first use
+	struct speculation *spec; // CORR_SPECULATE: searches run ahead, allocated on first use
+};
+
+// Dungeon generation
+bool dungeon_init(struct dungeon *d, int height, int width, int layout); // allocates a dungeon's buffers
+void dungeon_free(struct dungeon *d); // frees a dungeon's buffers and rooms
+void generate(struct dungeon *d, uint64_t seed, uint64_t level); // generates level k of seed, reusing the buffers
+void fprintMap(FILE *fp, const struct grid *g, const uint8_t map[]); // writes the map as rows of symbols
+int sprintMap(char *buf, const struct grid *g, const uint8_t map[]); // writes the map as rows of symbols into buf
+char getsymbol(int val); // returns a symbol based on a given value
+int getArea(const struct grid *g, const uint8_t map[]); // returns the sum of the map space
+int get_move_cost(int val); // given a tile type, returns the cost to move (or dig) through it
+int get_flags(int val); // given a tile type, returns its TF_ flags
+void populate_cost_map(const struct grid *g, uint8_t moveCost[], const uint8_t map[]); // derives the cost plane from the map
+void populate_flags(const struct grid *g, uint8_t flags[], const uint8_t map[]); // derives the flag plane from the map
+void set_placement(int type); // select how generate places the rooms
+int parse_placement(const char *name); // placement for a name given on the command line, INVALID if unknown
+bool set_density(int percent); // coverage PLACE_PACKED stops at, FAILURE if out of range
+void set_corridors(int type); // select how connect_rooms digs the corridors
+void set_lookahead(int threads); // select how many threads CORR_SPECULATE searches ahead on
+void speculate_stats(const struct dungeon *d, long *searched, long *reruns); // adds up the corridors searched ahead and run again
+int parse_corridors(const char *name); // corridor mode for a name given on the command line, INVALID if unknown
+void set_planner(int type); // select how connect_rooms picks the rooms to join
+int parse_planner(const char *name); // planner for a name given on the command line, INVALID if unknown
+int plan_links(const struct grid *g, struct rng *rng, const int links[], int n, int loops, int pairs[]); // spanning tree of the links, plus loops
+void dungeon_settile(struct dungeon *d, int key, int tile); // changes a finished level's tile, its cost and flags
+// level packs
+uint8_t *pack_dungeon(const struct dungeon *d, int encoding, size_t *len); // packs the level into a new record
+size_t pack_begin(FILE *fp); // writes the start of a pack
+void pack_end(FILE *fp, const uint64_t index[], uint64_t count, uint64_t at); // writes the index and end of a pack
+bool pack_open(struct pack *p, const char *path); // maps a pack into memory
+void pack_close(struct pack *p); // unmaps a pack
+const struct packlevel *pack_level(const struct pack *p, uint64_t i); // level i's record, in place
+const struct packroom *packlevel_rooms(const struct packlevel *l); // the record's rooms
+const struct packpoint *packlevel_points(const struct packlevel *l); // the record's links and stairs
+const uint8_t *packlevel_tiles(const struct packlevel *l); // the record's tiles, as encoded
+bool pack_unpack(const struct packlevel *l, const struct grid *g, uint8_t map[]); // decodes the tiles into a map
+// Map functions
+bool grid_init(struct grid *g, int height, int width, int layout); // describe a height x width map, FAILURE if out of range
+int parse_layout(const char *name); // layout for a name given on the command line, INVALID if unknown
+int *newmap(const struct grid *g); // allocates a zeroed map buffer for the grid
+uint8_t *newplane(const struct grid *g); // allocates a zeroed byte per cell buffer for the grid
 // Coordinate functions
-int hash(int y, int x);   // create hash from x and y coords
-int gety(int key);      // derive y coordinate from key
-int getx(int key);      // derive x coordinate from key
-int offsetkey(int key, int y, int x); // old key + (x + y offsets) = new key if valid
-int isvalid_key(int key, int y, int x); // returns whether a key is invalid
-int howfar(int from, int to); // measures the manhattan distance between two keys
+int hash(const struct grid *g, int y, int x);   // create hash from x and y coords
+int gety(const struct grid *g, int key);      // derive y coordinate from key
+int getx(const struct grid *g, int key);      // derive x coordinate from key
+int offsetkey(const struct grid *g, int key, int y, int x); // old key + (x + y offsets) = new key if valid
+bool inland(const struct grid *g, int key); // are all 8 neighbours on the map, a step[] away?
+int isvalid_key(const struct grid *g, int key, int y, int x); // returns whether a key is invalid
+int howfar(const struct grid *g, int from, int to); // measures the manhattan distance between two keys
 // misc utility functions
-int roll(int ndice, int faces); // roll(2, 4) = roll 2d4
-int randint(int min, int max); // rolls a result between min and max number
+int roll(struct rng *r, int ndice, int faces); // roll(2, 4) = roll 2d4
+int randint(struct rng *r, int min, int max); // rolls a result between min and max number
 bool isodd(int x); // returns whether an integer is odd
 float probfail(int a, int d); // probability of failing a roll 1da - 1db
 float probsucc(int a, int d); // probability of succeeding in a roll 1da - 1db
-void arrcpy(int from[], int to[]); // copy contents of an int map array to another
+void arrcpy(const struct grid *g, int from[], int to[]); // copy contents of an int map array to another
+// drafts
+bool draft_init(struct draft *t, uint8_t map[]); // starts an empty draft on map
+void draft_free(struct draft *t); // frees the draft's log
+bool draft_set(struct draft *t, int key, int val); // writes val to the map, logging the old value, FAILURE if out of memory
+void draft_commit(struct draft *t); // keeps every write since the last commit
+void draft_rollback(struct draft *t); // undoes every write since the last commit
+// bitboards
+bool bitboard_init(struct bitboard *b, int height, int width); // allocates a cleared board
+void bitboard_free(struct bitboard *b); // frees the board's bits
+void bitboard_clear(struct bitboard *b); // clears every bit
+bool bitboard_test(const struct bitboard *b, int y, int x, int height, int width); // is any cell of the rectangle set?
+void bitboard_set(struct bitboard *b, int y, int x, int height, int width); // sets every cell of the rectangle
+bool bitboard_get(const struct bitboard *b, int y, int x); // is the cell set?
+// random numbers
+void rng_seed(struct rng *r, uint64_t seed); // seeds the generator from a single value
+void rng_split(struct rng *r, uint64_t seed, uint64_t k); // seeds the generator for stream k of seed
+uint64_t rng_next(struct rng *r); // returns the next 64 random bits
+uint32_t rng_below(struct rng *r, uint32_t n); // returns a uniform integer in 0 .. n - 1
+void rng_fill(struct rng *r, uint32_t out[], int n); // fills out with n raw 32 bit draws
+uint32_t rng_scale(uint32_t draw, uint32_t n); // maps a raw draw to 0 .. n - 1
+// job scheduling
+void sched_run(int nthreads, long njobs, void (*job)(void *ctx, int worker, long index), void *ctx); // runs jobs on a work stealing pool
+int sched_cores(void); // returns the number of online processors
+struct crew *crew_start(int nthreads); // starts threads kept between batches of jobs
+void crew_run(struct crew *c, long njobs, void (*job)(void *ctx, int worker, long index), void *ctx); // runs jobs on the crew
+void crew_stop(struct crew *c); // stops the crew's threads and frees it
+// pools
+void pool_init(struct pool *p, size_t size, int per); // starts an empty pool of size byte items
+void pool_free(struct pool *p); // frees every slab and every item with them
+void *pool_alloc(struct pool *p); // returns an item, NULL if out of memory
+void pool_release(struct pool *p, void *item); // gives one item back
+void pool_reset(struct pool *p); // takes back every item, keeping the slabs
 // linked list functions for rooms
-void roomlist_append(struct room **list, struct room *r); // add room to room list
-void roomlist_purge(struct room **list); // frees all rooms in the room list
+void roomlist_init(struct roomlist *list); // starts an empty room list
+void roomlist_free(struct roomlist *list); // frees the list's rooms and their pool
+void roomlist_append(struct roomlist *list, struct room *r); // add a copy of room to the end of the room list
+void roomlist_purge(struct roomlist *list); // empties the room list, keeping the pool
 void copyRoom(struct room *from, struct room *to); // copies the contents of one room to another
 int room_listlen(struct room *list);
 // linked list functions for nodes
-void nodelist_append(struct node **list, int key); // add node to node list
-void nodelist_purge(struct node **list); // frees all rooms in the node list
-int nodelistlen(struct node *list); // counts all the members in a linked list
+struct node **nodelist_append(struct pool *p, struct node **tail, int key); // add node after tail, returns the new tail
+void nodelist_prepend(struct pool *p, struct node **list, int key); // add node to the front of the node list
+void nodelist_purge(struct pool *p, struct node **list); // gives every node in the node list back to the pool
+int node_listlen(struct node *list); // counts all the members in a linked list
 // pathfinding
-struct node *astar(int moveCost[], int start, int stop); // a* pathfinding algorithm
+struct node *astar(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop); // a* pathfinding algorithm
+struct node *jps(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop, int dirs); // jump point search
+struct node *findpath(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop); // path with the selected algorithm
+bool astar_search(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop); // astar, leaving the path in the workspace
+bool jps_search(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop, int dirs); // jps, leaving the path in the workspace
+bool findpath_search(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop); // findpath, leaving the path in the workspace
+bool findpath_keys(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop, struct path *p); // findpath into a key array
+bool search_back(struct search *s); // allocates the backward half of the workspace, for searches from the stop
+int search_bounded(struct search *s, const struct grid *g, const uint8_t moveCost[], int start, int stop,
+		struct budget *b, struct path *p); // a search within a budget of expansions or time, see bounded.c
+int search_path(const struct search *s, const struct grid *g, int stop, struct path *p); // copies the last search's path into a key array
+int path_encode(const struct grid *g, const int keys[], int n, uint8_t rle[], int cap); // packs a key array into run length directions
+int path_decode(const struct grid *g, int start, const uint8_t rle[], int n, int keys[], int cap); // unpacks run length directions into keys
+bool search_init(struct search *s, const struct grid *g); // allocates a workspace for searches on the grid
+void search_free(struct search *s); // frees the workspace's buffers
+void search_reset(struct search *s); // starts a new search, forgetting every cell
+void set_pathfinder(int type); // select the algorithm findpath uses
+int parse_pathfinder(const char *name); // pathfinder for a name given on the command line
+void create_Djikstra_Map(const struct grid *g, const uint8_t moveCost[], const int sources[], int n,
+		int costTo[], int cameFrom[]); // floods the map from the sources
+void distance_transform(const struct grid *g, const uint8_t moveCost[], const int sources[], int n,
+		int costTo[], int cameFrom[]); // same as create_Djikstra_Map, by raster sweeps
+void set_openset(int type); // select the priority queue backend used by the pathfinders
+int get_openset(void); // returns the priority queue backend used by the pathfinders
+int x(int i); // given a direction, return its x offset
+int y(int i); // given a direction, return its y offset
+void init(const struct grid *g, int *map, int val); // initialize map
+bool isValid(const struct grid *g, int key); // returns whether a key is valid
+// distance maps
+struct dmap *dmap_build(const struct grid *g, const uint8_t moveCost[], const int sources[], int n, uint64_t version); // floods a new map from the sources
+void set_dmap_engine(int type); // select how dmap_build floods, DM_FLOOD or DM_SWEEP
+struct dmap *dmap_retain(struct dmap *m); // adds an owner to the map
+void dmap_release(struct dmap *m); // drops an owner, the last one frees the map
+bool dmap_repair(struct dmap *m, const uint8_t moveCost[], const int changed[], int n, uint64_t version); // updates the map after cells change cost, FAILURE if out of memory
+int dmap_step(const struct dmap *m, int key); // next cell towards the nearest source
+bool dmap_cache_init(struct dmapcache *c, int cap); // starts an empty cache of up to cap maps
+void dmap_cache_free(struct dmapcache *c); // releases every cached map
+struct dmap *dmap_cache_get(struct dmapcache *c, const struct grid *g, const uint8_t moveCost[],
+		uint64_t version, const int sources[], int n); // cached map for the sources, built on a miss
+// hierarchical pathfinding
+bool hpa_init(struct hpa *h, const struct grid *g, const struct room *rooms, const int links[], int n,
+		uint64_t version); // chunks the map, with waypoints at the rooms and links
+void hpa_free(struct hpa *h); // frees the abstract layer
+void hpa_invalidate(struct hpa *h, const int changed[], int n, uint64_t version); // drops the chunks of cells whose cost changed
+bool hpa_path(struct hpa *h, struct search *s, const uint8_t moveCost[], uint64_t version,
+		int start, int stop, struct path *p); // plans across chunks, refines into p
+// many to many paths
+bool multipath_init(struct multipath *m, const struct grid *g, int threads); // a batch runner with threads workers
+void multipath_free(struct multipath *m); // frees the runner and its paths
+bool multipath_run(struct multipath *m, const uint8_t moveCost[], struct query q[], int n); // answers the queries into m->keys
+// search workspace access, inline as they sit in the pathfinders' inner loops
+// cost from start to key in the current search, MAX_STEPS if not reached yet
+static inline int search_cost(const struct search *s, int key)
+{
+	return s->stamp[key] == s->gen ? s->costTo[key] : MAX_STEPS;
+}
+
+// records that key is reached at cost through from
+static inline void search_visit(struct search *s, int key, int cost, int from)
+{
+	s->stamp[key] = s->gen;
+	s->costTo[key] = cost;
+	s->cameFrom[key] = from;
+}
+// priority queue functions
+bool pqueue_init(struct pqueue *q, int type, int cap); // creates an empty queue for keys 0 .. cap - 1
+void pqueue_free(struct pqueue *q); // frees the queue's buffers
+void pqueue_push(struct pqueue *q, int key, int priority); // push a key, or lower its priority if queued
+int pqueue_pop(struct pqueue *q); // pop the key with the lowest priority
+bool pqueue_empty(struct pqueue *q); // returns whether the queue is empty
+bool pqueue_contains(struct pqueue *q, int key); // returns whether a key is queued
+void pqueue_remove(struct pqueue *q, int key); // removes a key if it is queued
+void pqueue_purge(struct pqueue *q); // removes all remaining keys
@@ -0,0 +1,109 @@
+/******************************************************************************
+
+Random number generation
+
+xoshiro256** seeded through splitmix64. Each generator is a small value that
+lives in the state of whoever uses it, so levels can be generated on any
+thread in any order and come out the same. rng_split() derives the generator
+for level k of a seed directly, without drawing through levels 0 .. k - 1.
+
+*******************************************************************************/
+
+#include "rl.h"
+
+/* #################### FUNCTIONS ############################### */
+uint64_t splitmix64(uint64_t *x); // advances a splitmix64 state and returns its output
+uint64_t rotl(uint64_t x, int k); // rotate left
+/* ############################################################## */
+
+// seeds the generator from a single 64 bit value
+void rng_seed(struct rng *r, uint64_t seed)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        r->s[i] = splitmix64(&seed); // never all zero
+    return;
+}
+
+// seeds the generator for stream k of a seed, e.g. level k of a batch.
+// Streams of the same seed are independent of each other
+void rng_split(struct rng *r, uint64_t seed, uint64_t k)
+{
+    uint64_t x = k;
+
+    rng_seed(r, seed ^ splitmix64(&x)); // scramble k so nearby streams differ in every bit
+    return;
+}
+
+// returns the next 64 random bits
+uint64_t rng_next(struct rng *r)
+{
+    uint64_t *s = r->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// returns a uniform integer in 0 .. n - 1 without division in the common case
+uint32_t rng_below(struct rng *r, uint32_t n)
+{
+    uint64_t m = (rng_next(r) >> 32) * n; // high word of a 32x32 product lands in 0 .. n - 1
+    uint32_t threshold;
+
+    if ((uint32_t) m < n)
+    { // rarely, reject draws that would favour low results
+        threshold = -n % n;
+        while ((uint32_t) m < threshold)
+            m = (rng_next(r) >> 32) * n;
+    }
+    return m >> 32;
+}
+
+// fills out with n raw 32 bit draws, two per call to the generator.
+// Scale each with rng_scale(), for loops that need several draws per attempt
+void rng_fill(struct rng *r, uint32_t out[], int n)
+{
+    uint64_t bits;
+    int i;
+
+    for (i = 0; i + 1 < n; i += 2)
+    {
+        bits = rng_next(r);
+        out[i] = bits >> 32;
+        out[i + 1] = (uint32_t) bits;
+    }
+    if (i < n)
+        out[i] = rng_next(r) >> 32;
+    return;
+}
+
+// maps a raw 32 bit draw to 0 .. n - 1. The bias is at most n / 2^32,
+// which is far below anything a map sized range can show
+uint32_t rng_scale(uint32_t draw, uint32_t n)
+{
+    return ((uint64_t) draw * n) >> 32;
+}
+
+// advances a splitmix64 state and returns its output
+uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+// rotate left
+uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
@@ -0,0 +1,288 @@
+/******************************************************************************
+
+Work stealing job scheduler
+
+Runs jobs 0 .. njobs - 1 on a pool of threads. Each worker starts with an
+even share of the job indices as a range it takes from the front of. A worker
+that runs dry steals the back half of another worker's remaining range, so
+uneven jobs (big maps, unlucky seeds) don't leave cores idle at the end.
+The job function is told which worker runs it, so callers can keep one set
+of scratch buffers per worker and reuse it between jobs.
+
+sched_run starts its threads and joins them again. A caller that runs many
+small batches of jobs keeps a crew instead: threads started once, waiting
+between batches, so a batch costs a wake up rather than thread creation.
+
+*******************************************************************************/
+
+#include <pthread.h>
+#include "rl.h"
+
+struct jobrange {
+    pthread_mutex_t lock;
+    long lo, hi;            // jobs lo .. hi - 1 are still to run
+};
+
+struct sched {
+    int nworkers;
+    struct jobrange *ranges; // one per worker
+    void (*job)(void *ctx, int worker, long index);
+    void *ctx;
+};
+
+struct worker {
+    struct sched *s;
+    int id;
+    struct crew *crew;      // crews only: the crew the thread belongs to
+};
+
+// threads kept between batches, see crew_start
+struct crew {
+    struct sched s;         // the batch being run
+    struct worker *workers; // worker 0 is whoever calls crew_run
+    pthread_t *threads;
+    pthread_mutex_t lock;   // guards round, busy and quit
+    pthread_cond_t wake;    // a new round, or quit
+    pthread_cond_t done;    // the last worker finished the round
+    uint64_t round;         // batches started
+    int busy;               // threads still working on this round
+    bool quit;
+};
+
+/* #################### FUNCTIONS ############################### */
+void *sched_worker(void *arg); // runs jobs until every range is empty
+void sched_share(struct sched *s, long njobs); // gives each worker an even share of the jobs
+void *crew_worker(void *arg); // a crew thread: waits for a round, works it
+long sched_take(struct jobrange *r); // takes the next job from a worker's own range
+long sched_steal(struct sched *s, int thief); // moves half of another range to the thief
+/* ############################################################## */
+
+// runs job(ctx, worker, i) for every i in 0 .. njobs - 1 on nthreads threads
+// and returns once all of them have finished
+void sched_run(int nthreads, long njobs, void (*job)(void *ctx, int worker, long index), void *ctx)
+{
+    struct sched s;
+    struct worker *workers;
+    pthread_t *threads;
+    int i;
+
+    if (nthreads < 1)
+        nthreads = 1;
+    s.nworkers = nthreads;
+    s.job = job;
+    s.ctx = ctx;
+    s.ranges = malloc(nthreads * sizeof(struct jobrange));
+    workers = malloc(nthreads * sizeof(struct worker));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_mutex_init(&s.ranges[i].lock, NULL);
+        workers[i].s = &s;
+        workers[i].id = i;
+    }
+    sched_share(&s, njobs);
+    for (i = 1; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, sched_worker, &workers[i]);
+    sched_worker(&workers[0]); // the calling thread is worker 0
+    for (i = 1; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    for (i = 0; i < nthreads; i++)
+        pthread_mutex_destroy(&s.ranges[i].lock);
+    free(s.ranges);
+    free(workers);
+    free(threads);
+    return;
+}
+
+// starts a crew of nthreads workers, the caller of crew_run and nthreads - 1
+// threads waiting for work. NULL if out of memory or threads
+struct crew *crew_start(int nthreads)
+{
+    struct crew *c = calloc(1, sizeof(struct crew));
+    int i;
+
+    if (!c)
+        return NULL;
+    c->s.nworkers = nthreads > 0 ? nthreads : 1;
+    c->s.ranges = malloc(c->s.nworkers * sizeof(struct jobrange));
+    c->workers = malloc(c->s.nworkers * sizeof(struct worker));
+    c->threads = malloc(c->s.nworkers * sizeof(pthread_t));
+    if (!c->s.ranges || !c->workers || !c->threads)
+    {
+        free(c->s.ranges);
+        free(c->workers);
+        free(c->threads);
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->wake, NULL);
+    pthread_cond_init(&c->done, NULL);
+    for (i = 0; i < c->s.nworkers; i++)
+    {
+        pthread_mutex_init(&c->s.ranges[i].lock, NULL);
+        c->workers[i].s = &c->s;
+        c->workers[i].id = i;
+        c->workers[i].crew = c;
+    }
+    for (i = 1; i < c->s.nworkers; i++)
+        if (pthread_create(&c->threads[i], NULL, crew_worker, &c->workers[i]))
+        { // stop the ones started
+            c->s.nworkers = i;
+            crew_stop(c);
+            return NULL;
+        }
+    return c;
+}
+
+// runs job(ctx, worker, i) for every i in 0 .. njobs - 1 on the crew and
+// returns once all of them have finished. One caller at a time
+void crew_run(struct crew *c, long njobs, void (*job)(void *ctx, int worker, long index), void *ctx)
+{
+    c->s.job = job;
+    c->s.ctx = ctx;
+    sched_share(&c->s, njobs);
+    pthread_mutex_lock(&c->lock);
+    c->round++;
+    c->busy = c->s.nworkers - 1;
+    pthread_cond_broadcast(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+    sched_worker(&c->workers[0]);
+    pthread_mutex_lock(&c->lock);
+    while (c->busy > 0)
+        pthread_cond_wait(&c->done, &c->lock);
+    pthread_mutex_unlock(&c->lock);
+    return;
+}
+
+// stops the crew's threads and frees it
+void crew_stop(struct crew *c)
+{
+    int i;
+
+    if (!c)
+        return;
+    pthread_mutex_lock(&c->lock);
+    c->quit = true;
+    pthread_cond_broadcast(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+    for (i = 1; i < c->s.nworkers; i++)
+        pthread_join(c->threads[i], NULL);
+    for (i = 0; i < c->s.nworkers; i++)
+        pthread_mutex_destroy(&c->s.ranges[i].lock);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->wake);
+    pthread_cond_destroy(&c->done);
+    free(c->s.ranges);
+    free(c->workers);
+    free(c->threads);
+    free(c);
+    return;
+}
+
+// a crew thread: waits for each round, works it until every range is
+// empty and reports back, until the crew stops
+void *crew_worker(void *arg)
+{
+    struct worker *w = arg;
+    struct crew *c = w->crew;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&c->lock);
+    for (;;)
+    {
+        while (!c->quit && c->round == seen)
+            pthread_cond_wait(&c->wake, &c->lock);
+        if (c->quit)
+            break;
+        seen = c->round;
+        pthread_mutex_unlock(&c->lock);
+        sched_worker(w);
+        pthread_mutex_lock(&c->lock);
+        if (--c->busy == 0)
+            pthread_cond_signal(&c->done);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+// gives each worker a contiguous even share of jobs 0 .. njobs - 1 to start with
+void sched_share(struct sched *s, long njobs)
+{
+    int i;
+
+    for (i = 0; i < s->nworkers; i++)
+    {
+        pthread_mutex_lock(&s->ranges[i].lock);
+        s->ranges[i].lo = njobs * i / s->nworkers;
+        s->ranges[i].hi = njobs * (i + 1) / s->nworkers;
+        pthread_mutex_unlock(&s->ranges[i].lock);
+    }
+    return;
+}
+
+// returns the number of online processors, for a default thread count
+int sched_cores(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+// runs jobs until every range is empty. No new jobs appear while running,
+// so once a full pass over the other workers finds nothing the worker is done
+void *sched_worker(void *arg)
+{
+    struct worker *w = arg;
+    struct sched *s = w->s;
+    long i;
+
+    for (;;)
+    {
+        if ((i = sched_take(&s->ranges[w->id])) == INVALID &&
+            (i = sched_steal(s, w->id)) == INVALID)
+            break;
+        s->job(s->ctx, w->id, i);
+    }
+    return NULL;
+}
+
+// takes the next job from the front of a range, INVALID if it is empty
+long sched_take(struct jobrange *r)
+{
+    long i = INVALID;
+
+    pthread_mutex_lock(&r->lock);
+    if (r->lo < r->hi)
+        i = r->lo++;
+    pthread_mutex_unlock(&r->lock);
+    return i;
+}
+
+// steals the back half of the first non-empty range after the thief's own.
+// Returns the first stolen job to run now, the rest goes in the thief's range
+long sched_steal(struct sched *s, int thief)
+{
+    struct jobrange *victim, *own = &s->ranges[thief];
+    long lo = 0, hi = 0;
+    int i;
+
+    for (i = 1; i < s->nworkers && lo == hi; i++)
+    {
+        victim = &s->ranges[(thief + i) % s->nworkers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->lo < victim->hi)
+        { // the victim keeps the front half, which it reaches first
+            lo = victim->lo + (victim->hi - victim->lo) / 2;
+            hi = victim->hi;
+            victim->hi = lo;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if (lo == hi)
+        return INVALID; // every range is empty
+    pthread_mutex_lock(&own->lock);
+    own->lo = lo + 1;
+    own->hi = hi;
+    pthread_mutex_unlock(&own->lock);
+    return lo;
+}
@@ -7,105 +7,291 @@
 #define MAX_ROOMS		10
 #define MAX_ATTEMPTS 	30
 #define SPREAD 			1 	// min. # of tiles between rooms. Increasing requires more attempts
-
-enum { STONE, GRANITE, ROOM, BORDER, CORNER, CORRIDOR, O_DOOR, C_DOOR, 
-		IRONBARS, WATER, LAVA, LINK, SPACER, UPSTAIRS, DOWNSTAIRS};
+#define DRAWS			4	// random draws per attempt, 2 for size and 2 for placement
+#define LOOP_PERCENT	20	// PLAN_LOOPS: extra corridors, per 100 rooms
+#define MIN_RECT		3	// smallest room height and width
+#define ANCHOR_STEP		2	// PLACE_PACKED: cells between the room corners on offer
+#define DENSITY_DEFAULT	40	// PLACE_PACKED: percent of the map to cover with rooms and their walls
+#define SPEC_MIN		2	// CORR_SPECULATE: fewest corridors searched ahead at a time
+#define SPEC_MAX		8	// CORR_SPECULATE: most, each has a workspace the size of the map
+
+// CORR_SPECULATE: a corridor searched ahead of its turn, over the cost plane
+// as it was when its window of corridors started
+struct specslot {
+	struct search search;   // left as the search left it, to tell which cells it read
+	uint8_t *cost;          // the window's cost plane, with this search's overlay while it runs
+	struct path path;
+	int start, stop;
+};
+
+// CORR_SPECULATE: the corridors searched ahead and what digging them changed
+struct speculation {
+	struct grid grid;
+	int nslots, nthreads;
+	struct crew *crew;      // nthreads > 1: the threads the searches run on, kept between windows
+	struct specslot *slots;
+	int *changed, nchanged, changedcap; // cells whose cost the window's digging changed
+	long searched, reruns;  // corridors searched ahead, and run again as they read a changed cell
+};
+
+static int planner = PLAN_CHAIN; // how connect_rooms picks the rooms to join
+static int placement = PLACE_SCATTER; // how generate places the rooms
+static int density = DENSITY_DEFAULT; // PLACE_PACKED: coverage to stop at
+static int corridors = CORR_SERIAL; // how connect_rooms digs the corridors
+static int lookahead = 1; // CORR_SPECULATE: threads to search ahead on
 
 //bool printRect(int key, int width, int height); // prints a rectangle 
 // randomly place rooms, determine if they fit
-void selRoomSize(struct room *r); // select a random rectangle's size
-int selRoomPlacement(int height, int width); // select the placement for the room
-bool attemptRoom(int draft[], struct room *r); // attempts to place a room
-bool attemptBorders(int draft[], struct room *r); // attempts placement of borders
-bool attemptSpacers(int draft[], struct room *r); // does room violate min # of tiles between rooms?
+void selRoomSize(struct room *r, uint32_t draw[]); // select a random rectangle's size
+int selRoomPlacement(const struct grid *g, int height, int width, uint32_t draw[]); // select the placement for the room
+bool attemptRoom(const struct grid *g, struct draft *draft, struct room *r); // attempts to place a room
+bool attemptBorders(const struct grid *g, struct draft *draft, struct room *r); // attempts placement of borders
+bool attemptSpacers(const struct grid *g, struct draft *draft, struct room *r); // does room violate min # of tiles between rooms?
+bool isoccupied(const struct grid *g, struct bitboard *occ, struct room *r); // does the room's footprint overlap anything placed?
+void occupy(const struct grid *g, struct bitboard *occ, struct room *r); // marks the room's footprint as placed
+bool place_room(struct dungeon *d, struct room *r); // places the room if it fits
+void scatter_rooms(struct dungeon *d); // MAX_ROOMS rooms at random spots, MAX_ATTEMPTS tries each
+void pack_rooms(struct dungeon *d); // rooms at free corners until density is reached
+bool fitroom(const struct grid *g, struct bitboard *occ, struct room *r); // shrinks the room until it fits
 // linking rooms together
-void connect_rooms(int map[], struct room *roomlist); // connect the rooms on the map with tunnels
-void picklinks(int links[], struct room *roomlist); // popular array with room connects
-int chooselink(struct room *r); // choose link for room connection
-void sortlinks(int links[], int n); // sort the links by distance from the first link
-void populate_cost_map(int moveCost[], int map[]); // populate the movecost map for pathfinding
-int get_move_cost(int val); // given a mapval, returns a move cost
-void connect_links(int map[], int start, int stop); // connect the provided start and stop links on the map
+void connect_rooms(struct dungeon *d); // connect the rooms on the map with tunnels
+void picklinks(const struct grid *g, struct rng *rng, int links[], struct room *roomlist); // popular array with room connects
+int chooselink(const struct grid *g, struct rng *rng, struct room *r); // choose link for room connection
+void sortlinks(const struct grid *g, int links[], int n); // sort the links by distance from the first link
+void connect_links(const struct grid *g, struct search *s, struct path *p, uint8_t map[], uint8_t cost[], int start, int stop); // connect the provided start and stop links on the map
+bool connect_batch(struct dungeon *d, const int pairs[], int npairs); // CORR_BATCH: searches every corridor, then digs them
+bool connect_speculate(struct dungeon *d, const int pairs[], int npairs); // CORR_SPECULATE: searches ahead in parallel, digs in order
+struct speculation *spec_new(const struct grid *g); // allocates the slots
+void spec_free(struct speculation *sp); // frees the slots
+void spec_search(void *ctx, int worker, long i); // searches one slot's corridor over its plane
+bool spec_stale(const struct grid *g, const struct specslot *slot, const int changed[], int n); // did the search read a changed cell?
+void spec_note(const struct grid *g, struct speculation *sp, const uint8_t before[], const uint8_t after[], const int keys[], int n); // records the cells digging changed
 // utility functions for dungeon generation 
-void printMap(int map[]); // prints symbol on screen if coords on the map are true
-void tunnel(int map[], struct node *head_ref); // carve keys from a list
-void carve(int map[], int key); // carves a room out at key
-char getsymbol(int val); // returns a symbol based on a given value
-int getArea(int map[]); // returns the sum of the map space
+void tunnel(const struct grid *g, uint8_t map[], uint8_t cost[], const int keys[], int n); // carve keys from an array
+void carve(const struct grid *g, uint8_t map[], uint8_t cost[], int key); // carves a room out at key
+void settile(uint8_t map[], uint8_t cost[], int key, int tile); // writes a tile and its move cost
 bool isborder(int oy, int ox, struct room *r); // returns if border
 bool iscorner(int oy, int ox, struct room *r); // returns if corner
 
-int main(void)
+// allocates the buffers for a height x width dungeon stored in the given
+// cell layout, FAILURE if out of range
+bool dungeon_init(struct dungeon *d, int height, int width, int layout)
+{
+	memset(d, 0, sizeof(*d));
+	if (grid_init(&d->grid, height, width, layout) == FAILURE)
+		return FAILURE;
+	roomlist_init(&d->rooms);
+	d->map = newplane(&d->grid);
+	d->cost = newplane(&d->grid);
+	d->flags = newplane(&d->grid);
+	if (!d->map || !d->cost || !d->flags || draft_init(&d->draft, d->map) == FAILURE ||
+			bitboard_init(&d->occ, height, width) == FAILURE || search_init(&d->search, &d->grid) == FAILURE)
+	{
+		dungeon_free(d);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+// frees the dungeon's buffers and room list
+void dungeon_free(struct dungeon *d)
+{
+	free(d->map);
+	free(d->cost);
+	free(d->flags);
+	draft_free(&d->draft);
+	bitboard_free(&d->occ);
+	search_free(&d->search);
+	roomlist_free(&d->rooms);
+	free(d->anchors);
+	free(d->corridor.keys);
+	free(d->links);
+	if (d->multi)
+		multipath_free(d->multi);
+	free(d->multi);
+	spec_free(d->spec);
+	memset(d, 0, sizeof(*d));
+	return;
+}
+
+// generates level k of seed into the dungeon, reusing its buffers.
+// The same seed and level always give the same map
+void generate(struct dungeon *d, uint64_t seed, uint64_t level)
+{
+	struct grid *g = &d->grid;
+	uint8_t *final = d->map; // where changes are saved to map
+
+	memset(final, 0, g->size);
+	draft_commit(&d->draft);
+	bitboard_clear(&d->occ);
+	roomlist_purge(&d->rooms); // keeps copies of successful room placements, back to its pool in one go
+	d->seed = seed;
+	d->level = level;
+	d->version++; // distance maps of the old level are stale
+	rng_split(&d->rng, seed, level); // the level's own generator
+
+	if (placement == PLACE_PACKED)
+		pack_rooms(d);
+	else
+		scatter_rooms(d);
+	populate_cost_map(g, d->cost, final); // derived once, connect_rooms keeps it in step with its writes
+	connect_rooms(d);
+	populate_flags(g, d->flags, final);
+	return;
+}
+
+// places MAX_ROOMS rooms with MAX_ATTEMPTS tries per room, each try a random
+// size at a random spot
+void scatter_rooms(struct dungeon *d)
 {
 	struct room r; // room prototype, if it places on the map, a copy is added to the room list
-	struct room *roomlist = NULL; // keeps copies of successful room placements
-	int draft[AREA]; // working draft of the map, the "what if?"
-	int final[AREA]; // where changes are saved to map
+	uint32_t draws[MAX_ATTEMPTS * DRAWS]; // random draws for every attempt at one room
+	uint32_t *draw;
 	int i, j;
-	
-	memset(draft, 0, sizeof(draft));
-	arrcpy(draft, final);
-	initscr(); // initalize ncurses window
-	srand(time(0)); // seed random table
-	r.next = NULL; // not used for the prototype
 
-	// attempt to place MAX_ROOMS in MAX_ATTEMPTS per room 
+	r.next = NULL; // not used for the prototype
 	for (i = 0; i < MAX_ROOMS; i++)	 
-		for (j = 0; j < MAX_ATTEMPTS; j++)
+	{
+		rng_fill(&d->rng, draws, MAX_ATTEMPTS * DRAWS); // draw for all attempts in one go
+		for (j = 0, draw = draws; j < MAX_ATTEMPTS; j++, draw += DRAWS)
 		{
-			selRoomSize(&r); // randomly determine room size
-			r.coords = selRoomPlacement(r.height, r.width); // randomly determined valid coordinates
-			if (	attemptRoom(draft, &r) == SUCCESS    && 
-					attemptBorders(draft, &r) == SUCCESS &&
-					attemptSpacers(draft, &r) == SUCCESS 
-			   )
-			{ // if placement on draft is successful for both rooms and borders
-				arrcpy(draft, final); // copy draft to final
-				roomlist_append(&roomlist, &r);
+			selRoomSize(&r, draw); // randomly determine room size
+			r.coords = selRoomPlacement(&d->grid, r.height, r.width, draw + 2); // randomly determined valid coordinates
+			if (place_room(d, &r) == SUCCESS)
 				break; // move on to placement of next room up to MAX_ROOMS
+		}
+	}
+	return;
+}
+
+// places rooms until they and their walls cover density percent of the map,
+// or no room fits anywhere. Only room corners where the smallest room still
+// fits are offered: the corners right next to the rooms placed so far first,
+// so rooms pack tight, then random ones off a lattice. A random size is
+// shrunk until it fits, and a lattice corner found full is dropped for good,
+// as the map only fills up. Each draw places a room or drops a corner, so
+// the cost per room stays flat however full the map gets. Out of memory it
+// stops with the rooms placed so far
+void pack_rooms(struct dungeon *d)
+{
+	struct grid *g = &d->grid;
+	struct room r;
+	uint32_t draw[2]; // random draws for the size
+	const int MARGIN = 1 + SPREAD; // border + spacers, the least space above and left of a room
+	int *next = NULL, *grown; // corners next to placed rooms, taken last in first out
+	int nnext = 0, cap = 0;
+	int y, x, i, n = 0;
+	long covered = 0, goal = (long) g->area * density / 100;
+	bool near;
+
+	if (!d->anchors)
+		d->anchors = malloc(((g->height / ANCHOR_STEP + 1) * (g->width / ANCHOR_STEP + 1)) * sizeof(int));
+	if (!d->anchors)
+		return;
+	for (y = MARGIN; y + MIN_RECT + 2 <= g->height; y += ANCHOR_STEP) // +2: border and a row of stone below
+		for (x = MARGIN; x + MIN_RECT + 2 <= g->width; x += ANCHOR_STEP)
+			d->anchors[n++] = hash(g, y, x);
+	r.next = NULL;
+	while ((n > 0 || nnext > 0) && covered < goal)
+	{
+		near = nnext > 0;
+		i = near ? --nnext : (int) rng_below(&d->rng, n);
+		rng_fill(&d->rng, draw, 2);
+		selRoomSize(&r, draw);
+		r.coords = near ? next[i] : d->anchors[i];
+		if (fitroom(g, &d->occ, &r) == SUCCESS && place_room(d, &r) == SUCCESS)
+		{
+			covered += (r.height + 2) * (r.width + 2);
+			if (nnext + 2 > cap)
+			{
+				if (!(grown = realloc(next, (cap ? cap * 2 : 64) * sizeof(int))))
+					break;
+				next = grown;
+				cap = cap ? cap * 2 : 64;
 			}
-			else
-				arrcpy(final, draft); // reset draft to last final, attempt again til MAX
+			y = gety(g, r.coords);
+			x = getx(g, r.coords);
+			if (y + r.height + MARGIN * 2 < g->height) // below, flush with its footprint
+				next[nnext++] = hash(g, y + r.height + MARGIN * 2, x);
+			if (x + r.width + MARGIN * 2 < g->width) // and to the right, tried first
+				next[nnext++] = hash(g, y, x + r.width + MARGIN * 2);
 		}
-	connect_rooms(final, roomlist);
-	printMap(final);
-	printw("%d", getArea(final));	
-	roomlist_purge(&roomlist);
-	refresh();
-	getch();
-	endwin();
-	
-	return 0;
+		else if (!near)
+			d->anchors[i] = d->anchors[--n]; // full, and stays full
+	}
+	free(next);
+	return;
+}
+
+// shrinks the room at its corner, the longer side first, until it is on the
+// map and its footprint is free. FAILURE if not even the smallest room fits
+bool fitroom(const struct grid *g, struct bitboard *occ, struct room *r)
+{
+	int y = gety(g, r->coords), x = getx(g, r->coords);
+
+	for (;;)
+	{
+		if (y + r->height + 2 <= g->height && x + r->width + 2 <= g->width && !isoccupied(g, occ, r))
+			return SUCCESS; // same bounds as selRoomPlacement
+		if (r->height == MIN_RECT && r->width == MIN_RECT)
+			return FAILURE;
+		if (r->height >= r->width && r->height > MIN_RECT)
+			r->height -= 2; // sizes stay odd
+		else
+			r->width -= 2;
+	}
 }
 
-// selects the size of a rectangle
-void selRoomSize(struct room *r)
+// places the room on the map, its borders and spacers, and adds a copy to
+// the room list. FAILURE, with the map untouched, if it overlaps anything
+// or the draft runs out of memory
+bool place_room(struct dungeon *d, struct room *r)
+{
+	struct grid *g = &d->grid;
+	struct draft *draft = &d->draft; // tentative writes to the map, the "what if?"
+
+	if (	!isoccupied(g, &d->occ, r)              && // cheap test first, most attempts fail here
+			attemptRoom(g, draft, r) == SUCCESS    && 
+			attemptBorders(g, draft, r) == SUCCESS &&
+			attemptSpacers(g, draft, r) == SUCCESS 
+	   )
+	{ // if placement on draft is successful for both rooms and borders
+		draft_commit(draft); // keep the draft's writes
+		occupy(g, &d->occ, r);
+		roomlist_append(&d->rooms, r);
+		return SUCCESS;
+	}
+	draft_rollback(draft); // undo the draft's writes
+	return FAILURE;
+}
+
+// selects the size of a rectangle from two random draws
+void selRoomSize(struct room *r, uint32_t draw[])
 {
-	const int MIN_RECT = 3; // offset by minimum allowed height and width
 	const int MAX_TYPES = 4; // max types of rectangle dimensions 0 - 4
 	const int ODDS_ONLY = 2; // multiplier to choose odds only
 
 	// valid dimensions can be { 3, 5, 7, 9, or 11 }
 
-	r->height = (rand() % (MAX_TYPES - 1) ) * ODDS_ONLY + MIN_RECT;
-	r->width = (rand() % MAX_TYPES) * ODDS_ONLY + MIN_RECT;
+	r->height = rng_scale(draw[0], MAX_TYPES - 1) * ODDS_ONLY + MIN_RECT; // offset by minimum allowed height and width
+	r->width = rng_scale(draw[1], MAX_TYPES) * ODDS_ONLY + MIN_RECT;
 	return;
 } 
 
-// select placement of rectangle
-int selRoomPlacement(int height, int width)
+// select placement of rectangle from two random draws
+int selRoomPlacement(const struct grid *g, int height, int width, uint32_t draw[])
 {
 	int y, x;
 	const int MIN_PLACEMENT = 1 + SPREAD;
 	const int MAX_OFFSET = 2 + SPREAD; // -1 for start from zero, -1 borders, -SPREAD
 
-	y = rand() % (HEIGHT_MAX - MAX_OFFSET - height) + MIN_PLACEMENT;
-	x = rand() % (WIDTH_MAX - MAX_OFFSET - width) + MIN_PLACEMENT; 
-	return hash(y, x);
+	y = rng_scale(draw[0], g->height - MAX_OFFSET - height) + MIN_PLACEMENT;
+	x = rng_scale(draw[1], g->width - MAX_OFFSET - width) + MIN_PLACEMENT; 
+	return hash(g, y, x);
 }
 
-// attempts placement of a room to draft array starting at coords "key"
-bool attemptRoom(int draft[], struct room *r)
+// attempts placement of a room to draft starting at coords "key"
+bool attemptRoom(const struct grid *g, struct draft *draft, struct room *r)
 {
 	int i, j;
 	int dest; // destination
@@ -113,38 +299,36 @@ bool attemptRoom(int draft[], struct room *r)
 	for (i = 0; i < r->height; i++)
 		for (j = 0; j < r->width; j++)
 		{
-			dest = offsetkey(r->coords, i, j);
+			dest = offsetkey(g, r->coords, i, j);
 			if (dest == INVALID)
 				return FAILURE; // something went wrong
-			else if(draft[dest] == ROOM)
+			else if(draft->map[dest] == ROOM)
 				return FAILURE; // overlap
-			else
-				draft[dest] = ROOM;
+			else if (draft_set(draft, dest, ROOM) == FAILURE)
+				return FAILURE; // out of memory, the draft is abandoned
 		}
 	return SUCCESS;
 }
 
-// attempts placement of a room borders to draft array given coords "key"
-bool attemptBorders(int draft[], struct room *r)
+// attempts placement of a room borders to draft given coords "key"
+bool attemptBorders(const struct grid *g, struct draft *draft, struct room *r)
 {
 	int i, j;
 	int key, dest; // destination
 
-	key = offsetkey(r->coords, -1, -1); 
+	key = offsetkey(g, r->coords, -1, -1); 
 	for (i = 0; i < r->height + 2; i++) // y
 		for (j = 0; j < r->width + 2; j++) // x
 		{
 			if (isborder(i, j, r))
 			{ // if border
-				dest = offsetkey(key, i, j);
+				dest = offsetkey(g, key, i, j);
 				if (dest == INVALID)
 					return FAILURE; // something went wrong
-				else if(draft[dest])
+				else if(draft->map[dest])
 					return FAILURE; // overlap
-				else if (iscorner(i, j, r))
-						draft[dest] = CORNER; // if corner
-				else
-					draft[dest] = BORDER;
+				else if (draft_set(draft, dest, iscorner(i, j, r) ? CORNER : BORDER) == FAILURE)
+					return FAILURE; // out of memory
 			}
 		}
 	return SUCCESS;
@@ -152,12 +336,12 @@ bool attemptBorders(int draft[], struct room *r)
 
 // makes sure rooms aren't placed too close together
 // determined by SPREAD, i.e. minimum number of tiles between rooms
-bool attemptSpacers(int draft[], struct room *r)
+bool attemptSpacers(const struct grid *g, struct draft *draft, struct room *r)
 {
 	int i, j;
 	int key, dest; // destination
 
-	if ((key = offsetkey(r->coords, -1 - SPREAD, -1 - SPREAD)) != INVALID)
+	if ((key = offsetkey(g, r->coords, -1 - SPREAD, -1 - SPREAD)) != INVALID)
 	{
 		for (i = 0; i < r->height + ((1 + SPREAD) * 2); i++) // y
 			for (j = 0; j < r->width + ((1 + SPREAD) * 2); j++) // x
@@ -166,12 +350,12 @@ bool attemptSpacers(int draft[], struct room *r)
 						j < SPREAD || j > r->width + (1 + SPREAD * 2) - SPREAD
 				   )
 				{ // if spacer
-					if ( (dest = offsetkey(key, i, j)) != INVALID)
+					if ( (dest = offsetkey(g, key, i, j)) != INVALID)
 					{ 
-						if (draft[dest])
+						if (draft->map[dest])
 							return FAILURE; // overlap detected
-						else
-							draft[dest] = SPACER;
+						else if (draft_set(draft, dest, SPACER) == FAILURE)
+							return FAILURE; // out of memory
 					}
 				}
 			}
@@ -181,45 +365,400 @@ bool attemptSpacers(int draft[], struct room *r)
 		return FAILURE; // key is invalid, cannot hash
 }
 
+// does the room's footprint, the room with its borders and spacers, overlap
+// anything placed before? Footprints are solid rectangles, so this fails
+// exactly when one of the attempt functions would
+bool isoccupied(const struct grid *g, struct bitboard *occ, struct room *r)
+{
+	const int MARGIN = 1 + SPREAD; // border + spacers around each side
+
+	return bitboard_test(occ, gety(g, r->coords) - MARGIN, getx(g, r->coords) - MARGIN,
+			r->height + MARGIN * 2, r->width + MARGIN * 2);
+}
+
+// marks the room's footprint as placed
+void occupy(const struct grid *g, struct bitboard *occ, struct room *r)
+{
+	const int MARGIN = 1 + SPREAD; // border + spacers around each side
+
+	bitboard_set(occ, gety(g, r->coords) - MARGIN, getx(g, r->coords) - MARGIN,
+			r->height + MARGIN * 2, r->width + MARGIN * 2);
+	return;
+}
+
+// select how generate places the rooms:
+// PLACE_SCATTER - MAX_ROOMS rooms, each tried at up to MAX_ATTEMPTS random spots
+// PLACE_PACKED  - as many rooms as it takes to cover the density, see pack_rooms
+void set_placement(int type)
+{
+	placement = type;
+	return;
+}
+
+// placement for a name given on the command line, INVALID if unknown
+int parse_placement(const char *name)
+{
+	if (strcmp(name, "scatter") == 0)
+		return PLACE_SCATTER;
+	else if (strcmp(name, "packed") == 0)
+		return PLACE_PACKED;
+	return INVALID;
+}
+
+// PLACE_PACKED stops once rooms and their walls cover percent of the map,
+// FAILURE if not 1 .. 100
+bool set_density(int percent)
+{
+	if (percent < 1 || percent > 100)
+		return FAILURE;
+	density = percent;
+	return SUCCESS;
+}
+
+// select how connect_rooms picks the rooms to join:
+// PLAN_CHAIN - each room to the nearest one not joined yet, in a chain
+// PLAN_MST   - a minimum spanning tree of the rooms, shortest corridors first
+// PLAN_LOOPS - the tree plus LOOP_PERCENT extra corridors per 100 rooms
+void set_planner(int type)
+{
+	planner = type;
+	return;
+}
+
+// planner for a name given on the command line, INVALID if unknown
+int parse_planner(const char *name)
+{
+	if (strcmp(name, "chain") == 0)
+		return PLAN_CHAIN;
+	else if (strcmp(name, "mst") == 0)
+		return PLAN_MST;
+	else if (strcmp(name, "loops") == 0)
+		return PLAN_LOOPS;
+	else
+		return INVALID;
+}
+
+// select how connect_rooms digs the corridors it planned:
+// CORR_SERIAL - searches and digs each in turn, so later corridors can run
+//               along earlier ones
+// CORR_BATCH  - searches every corridor over the map as it was before any
+//               was dug, as one batch of queries, then digs them in order
+// CORR_SPECULATE - the serial level, with corridors searched ahead on the
+//               threads set_lookahead gives it, see connect_speculate
+void set_corridors(int type)
+{
+	corridors = type;
+	return;
+}
+
+// select how many threads CORR_SPECULATE searches ahead on. With 1 there is
+// nothing to gain and the corridors are dug serially. A dungeon keeps the
+// count it first searched ahead with
+void set_lookahead(int threads)
+{
+	lookahead = threads > 0 ? threads : 1;
+	return;
+}
+
+// adds the corridors the dungeon has searched ahead so far, and those run
+// again as an earlier corridor changed what they read, to the counts
+void speculate_stats(const struct dungeon *d, long *searched, long *reruns)
+{
+	if (d->spec)
+	{
+		*searched += d->spec->searched;
+		*reruns += d->spec->reruns;
+	}
+	return;
+}
+
+// corridor mode for a name given on the command line, INVALID if unknown
+int parse_corridors(const char *name)
+{
+	if (strcmp(name, "serial") == 0)
+		return CORR_SERIAL;
+	else if (strcmp(name, "batch") == 0)
+		return CORR_BATCH;
+	else if (strcmp(name, "speculate") == 0)
+		return CORR_SPECULATE;
+	return INVALID;
+}
+
 // connect the rooms on the map with tunnels
-void connect_rooms(int map[], struct room *roomlist)
-{
-	int n = room_listlen(roomlist);
-	int links[n];
-	int i, start, stop;
-	struct node *path;
-	picklinks(links, roomlist);
-	sortlinks(links, n); // sorts nodes by distance from the first node
+void connect_rooms(struct dungeon *d)
+{
+	struct grid *g = &d->grid;
+	uint8_t *map = d->map;
+	int n = d->rooms.n;
+	int *links;
+	int i, start, stop, loops, npairs, *pairs;
+
+	if (n > d->linkcap)
+	{ // kept with the level, one link per room
+		d->linkcap = n * 2;
+		d->links = realloc(d->links, d->linkcap * sizeof(int));
+	}
+	links = d->links;
+	d->nlinks = n;
+	picklinks(g, &d->rng, links, d->rooms.head);
+	if (planner == PLAN_CHAIN)
+		sortlinks(g, links, n); // sorts nodes by distance from the first node
 	for (i = 0; i < n; i++)
-		map[links[i]] = LINK;
+		settile(map, d->cost, links[i], LINK);
 
-	for (i = 0; i < n - 1; i++)
-	{ // for each pair of links, connect them
-		start = links[i];
-		stop = links[i + 1];
-		connect_links(map, start, stop);
+	if (planner == PLAN_CHAIN && corridors == CORR_SERIAL)
+	{
+		for (i = 0; i < n - 1; i++)
+		{ // for each pair of links, connect them
+			start = links[i];
+			stop = links[i + 1];
+			connect_links(g, &d->search, &d->corridor, map, d->cost, start, stop);
+		}
+		return;
 	}
+	loops = planner == PLAN_LOOPS ? n * LOOP_PERCENT / 100 : 0;
+	pairs = malloc(2 * (n + loops) * sizeof(int));
+	if (planner == PLAN_CHAIN)
+		for (i = npairs = 0; i < n - 1; i++, npairs++)
+		{ // the chain's pairs, for a batch
+			pairs[i * 2] = i;
+			pairs[i * 2 + 1] = i + 1;
+		}
+	else
+		npairs = plan_links(g, &d->rng, links, n, loops, pairs);
+	if (corridors == CORR_SERIAL || (corridors == CORR_SPECULATE && lookahead < 2) ||
+			(corridors == CORR_BATCH ? connect_batch(d, pairs, npairs) :
+			connect_speculate(d, pairs, npairs)) == FAILURE)
+		for (i = 0; i < npairs; i++) // shortest first
+			connect_links(g, &d->search, &d->corridor, map, d->cost, links[pairs[i * 2]], links[pairs[i * 2 + 1]]);
+	free(pairs);
+	return;
+}
+
+// searches the corridor between every pair of links over the map as it is,
+// as one batch of queries, then digs them in order. Without the overlay
+// connect_links puts on the ends a path costs its stop more, the same for
+// every way there, so the paths are the cheapest all the same. FAILURE,
+// with nothing dug, if out of memory
+bool connect_batch(struct dungeon *d, const int pairs[], int npairs)
+{
+	struct query *q = malloc((npairs ? npairs : 1) * sizeof(struct query));
+	int i;
+
+	if (!q || (!d->multi && (!(d->multi = malloc(sizeof(struct multipath))) ||
+		multipath_init(d->multi, &d->grid, 1) == FAILURE)))
+	{ // levels are generated a core each already, so one worker
+		free(d->multi);
+		d->multi = NULL;
+		free(q);
+		return FAILURE;
+	}
+	for (i = 0; i < npairs; i++)
+	{
+		q[i].start = d->links[pairs[i * 2]];
+		q[i].stop = d->links[pairs[i * 2 + 1]];
+	}
+	if (multipath_run(d->multi, d->cost, q, npairs) == FAILURE)
+	{
+		free(q);
+		return FAILURE;
+	}
+	for (i = 0; i < npairs; i++)
+		if (q[i].len > 0) // no path, nothing to carve
+			tunnel(&d->grid, d->map, d->cost, d->multi->keys + q[i].at, q[i].len);
+	free(q);
+	return SUCCESS;
+}
+
+// digs the corridors between the pairs of links exactly as the serial loop
+// would, with the searches run ahead. A window of corridors is searched at
+// once on the dungeon's crew of threads, over the cost plane as it was
+// before the window, then dug in order. Digging changes the costs around a corridor, so a
+// search that read a cell an earlier corridor of the window changed is run
+// again, over the map as it is by then. Any other search read the same
+// costs the serial one would, so it found the same path: on levels of many
+// rooms most corridors never come near each other. FAILURE, with nothing
+// dug, if out of memory
+bool connect_speculate(struct dungeon *d, const int pairs[], int npairs)
+{
+	const struct grid *g = &d->grid;
+	struct speculation *sp;
+	struct specslot *slot;
+	const int *keys;
+	int first, n, i, k, len;
+
+	if (!d->spec && !(d->spec = spec_new(g)))
+		return FAILURE;
+	sp = d->spec;
+	for (k = 0; k < sp->nslots; k++)
+		memcpy(sp->slots[k].cost, d->cost, g->size);
+	for (first = 0; first < npairs; first += n)
+	{
+		n = npairs - first < sp->nslots ? npairs - first : sp->nslots;
+		for (k = 0; k < n; k++)
+		{
+			sp->slots[k].start = d->links[pairs[(first + k) * 2]];
+			sp->slots[k].stop = d->links[pairs[(first + k) * 2 + 1]];
+		}
+		if (sp->crew)
+			crew_run(sp->crew, n, spec_search, sp);
+		else
+			for (k = 0; k < n; k++)
+				spec_search(sp, 0, k);
+		sp->searched += n;
+
+		sp->nchanged = 0;
+		for (k = 0; k < n; k++)
+		{ // in order, as the serial loop digs them
+			slot = &sp->slots[k];
+			if (spec_stale(g, slot, sp->changed, sp->nchanged))
+			{
+				connect_links(g, &d->search, &d->corridor, d->map, d->cost, slot->start, slot->stop);
+				keys = d->corridor.keys;
+				len = d->corridor.len;
+				sp->reruns++;
+			}
+			else
+			{
+				tunnel(g, d->map, d->cost, slot->path.keys, slot->path.len);
+				keys = slot->path.keys;
+				len = slot->path.len;
+			}
+			spec_note(g, sp, sp->slots[0].cost, d->cost, keys, len);
+		}
+		for (i = 0; i < sp->nchanged; i++) // every plane up to date for the next window
+			for (k = 0; k < sp->nslots; k++)
+				sp->slots[k].cost[sp->changed[i]] = d->cost[sp->changed[i]];
+	}
+	return SUCCESS;
+}
+
+// allocates the slots for searching ahead on grid g, one per lookahead
+// thread within SPEC_MIN .. SPEC_MAX, and starts the threads. NULL if out
+// of memory
+struct speculation *spec_new(const struct grid *g)
+{
+	struct speculation *sp = calloc(1, sizeof(struct speculation));
+	int k;
+
+	if (!sp)
+		return NULL;
+	sp->grid = *g;
+	sp->nthreads = lookahead;
+	sp->nslots = sp->nthreads < SPEC_MIN ? SPEC_MIN : sp->nthreads > SPEC_MAX ? SPEC_MAX : sp->nthreads;
+	if (!(sp->slots = calloc(sp->nslots, sizeof(struct specslot))) ||
+		(sp->nthreads > 1 && !(sp->crew = crew_start(sp->nthreads < sp->nslots ? sp->nthreads : sp->nslots))))
+	{
+		spec_free(sp);
+		return NULL;
+	}
+	for (k = 0; k < sp->nslots; k++)
+		if (search_init(&sp->slots[k].search, g) == FAILURE || !(sp->slots[k].cost = newplane(g)))
+		{
+			spec_free(sp);
+			return NULL;
+		}
+	return sp;
+}
+
+// frees the slots
+void spec_free(struct speculation *sp)
+{
+	int k;
+
+	if (!sp)
+		return;
+	crew_stop(sp->crew);
+	for (k = 0; sp->slots && k < sp->nslots; k++)
+	{
+		if (sp->slots[k].search.size)
+			search_free(&sp->slots[k].search);
+		free(sp->slots[k].cost);
+		free(sp->slots[k].path.keys);
+	}
+	free(sp->slots);
+	free(sp->changed);
+	free(sp);
+	return;
+}
+
+// searches slot i's corridor over the slot's own plane, with the overlay
+// connect_links puts on the ends
+void spec_search(void *ctx, int worker, long i)
+{
+	struct speculation *sp = ctx;
+	struct specslot *slot = &sp->slots[i];
+	const struct grid *g = &sp->grid;
+	uint8_t under[2] = { slot->cost[slot->start], slot->cost[slot->stop] };
+
+	(void) worker; // every slot has its own workspace
+	slot->cost[slot->start] = 0;
+	slot->cost[slot->stop] = 0;
+	if (findpath_keys(&slot->search, g, slot->cost, slot->start, slot->stop, &slot->path) == FAILURE &&
+		slot->path.len > slot->path.cap)
+	{ // found, but the buffer is short
+		slot->path.cap = slot->path.len * 2;
+		slot->path.keys = realloc(slot->path.keys, slot->path.cap * sizeof(int));
+		search_path(&slot->search, g, slot->stop, &slot->path);
+	}
+	slot->cost[slot->stop] = under[1];
+	slot->cost[slot->start] = under[0];
+	return;
+}
+
+// returns whether the slot's search read any of the n changed cells: a cell
+// it reached, a row jps scanned, or a cell that was blocked, which searches
+// read without reaching
+bool spec_stale(const struct grid *g, const struct specslot *slot, const int changed[], int n)
+{
+	const struct search *s = &slot->search;
+	int i;
 
+	for (i = 0; i < n; i++)
+		if (s->stamp[changed[i]] == s->gen || s->rowstamp[gety(g, changed[i])] == s->gen ||
+			slot->cost[changed[i]] == COST_BLOCKED)
+			return true;
+	return false;
+}
+
+// records the cells around the n keys of a dug corridor whose cost is no
+// longer what it was at the start of the window
+void spec_note(const struct grid *g, struct speculation *sp, const uint8_t before[], const uint8_t after[], const int keys[], int n)
+{
+	int i, dir, key;
+
+	for (i = 0; i < n; i++)
+		for (dir = 0; dir < ALLDIRS; dir++)
+		{ // carve writes the cell and a border around it
+			if ((key = offsetkey(g, keys[i], y(dir), x(dir))) == INVALID || before[key] == after[key])
+				continue;
+			if (sp->nchanged == sp->changedcap)
+			{
+				sp->changedcap = sp->changedcap ? sp->changedcap * 2 : 256;
+				sp->changed = realloc(sp->changed, sp->changedcap * sizeof(int));
+			}
+			sp->changed[sp->nchanged++] = key;
+		}
 	return;
 }
 
 // populate array with room connection keys
-void picklinks(int links[], struct room *roomlist)
+void picklinks(const struct grid *g, struct rng *rng, int links[], struct room *roomlist)
 {
 	struct room *curr;
 	int i;
 	for (curr = roomlist, i = 0; curr; curr = curr->next, i++)
-		links[i] = chooselink(curr);
+		links[i] = chooselink(g, rng, curr);
 	return;
 }
 
 // given a room, returns a key of a border tile that will be connected to another room
-int chooselink(struct room *r)
+int chooselink(const struct grid *g, struct rng *rng, struct room *r)
 {
 	int n = (r->width * 2 + r->height * 2) - 4; // border tiles less 4 corners
-	int choice = rand() % (n - 1); // start count from zero
+	int choice = rng_below(rng, n - 1); // start count from zero
 	int cnt = 0;
-	int key = offsetkey(r->coords, -1, -1);
+	int key = offsetkey(g, r->coords, -1, -1);
 	int i, j = 0;
 
 	for (i = 0; i < r->height + 2; i++)
@@ -227,15 +766,15 @@ int chooselink(struct room *r)
 			if (isborder(i, j, r) && !iscorner(i, j, r)) // if border
 			{ // if is border but not a corner
 				if (cnt == choice || cnt == n - 1)
-					return offsetkey(key, i, j);
+					return offsetkey(g, key, i, j);
 				else
 					cnt++;
 			}
-	return offsetkey(key, --i, --j);	// default case if error
+	return offsetkey(g, key, --i, --j);	// default case if error
 }
 
 // sort connection nodes by minimum distance from the first node in the list
-void sortlinks(int sorted[], int n)
+void sortlinks(const struct grid *g, int sorted[], int n)
 {
 	int min, dist, i, j, pos; // dist = distance, pos = position
 	int tmp; // temp container
@@ -243,9 +782,10 @@ void sortlinks(int sorted[], int n)
 	for (i = 0; i < n - 1; i++) // for each member in the list
 	{
 		min = MAX_STEPS;
+		pos = i + 1;
 		for (j = i + 1; j < n; j++) // compare distance between the remaining nodes in the list
 		{
-			if ((dist = howfar(sorted[i], sorted[j])) < min)
+			if ((dist = howfar(g, sorted[i], sorted[j])) < min)
 			{ // if distance measured between 2 nodes is shorter than current known min.
 				min = dist; // update minimum distance
 				pos = j;    // note position of the closest node in list
@@ -258,73 +798,106 @@ void sortlinks(int sorted[], int n)
 	return;
 }
 
-// connect the provided start and stop links on the map
-void connect_links(int map[], int start, int stop)
+// connect the provided start and stop links on the map. costMap matches the
+// map on entry and on return. The start and stop are free to enter for this
+// search only, an overlay that is taken off again before carving. The path
+// goes into p, grown when a corridor is longer than any before it
+void connect_links(const struct grid *g, struct search *s, struct path *p, uint8_t map[], uint8_t costMap[], int start, int stop)
 {
-	int costMap[AREA];
-	int i;
-	struct node *path = NULL;
+	uint8_t under[2] = { costMap[start], costMap[stop] }; // costs under the overlay
 
-	memset(costMap, 0, sizeof(costMap));
-	for (i = 0; i < AREA; i++)
-		costMap[i] = get_move_cost(map[i]);
 	costMap[start] = 0;
 	costMap[stop] = 0;
-	path = astar(costMap, start, stop);
-	tunnel(map, path);
-	nodelist_purge(&path);
+	if (findpath_keys(s, g, costMap, start, stop, p) == FAILURE && p->len > p->cap)
+	{ // found, but the buffer is short: grow it and copy the path out again
+		p->cap = p->len * 2;
+		p->keys = realloc(p->keys, p->cap * sizeof(int));
+		search_path(s, g, stop, p);
+	}
+	costMap[stop] = under[1]; // reverse order, in case start is stop
+	costMap[start] = under[0];
+	tunnel(g, map, costMap, p->keys, p->len); // no path, nothing to carve
 
 	return;
 }
 
-void tunnel(int map[], struct node *head_ref)
+// carves the n keys of a path
+void tunnel(const struct grid *g, uint8_t map[], uint8_t cost[], const int keys[], int n)
 {
-	struct node *curr;
-	for (curr = head_ref; curr; curr = curr->next)
-		carve(map, curr->key);
+	int i;
+
+	for (i = 0; i < n; i++)
+		carve(g, map, cost, keys[i]);
 	return;
 }
 
-// carves a room at coordinates
-void carve(int map[], int key)
+// carves a room at coordinates, updating the move cost of every cell it changes
+void carve(const struct grid *g, uint8_t map[], uint8_t cost[], int key)
 {
-	int i, j;
+	int i;
 	int offset;
+	bool inside;
 
 	if (map[key] != ROOM) // add room to room map
 	{
-		map[key] = ROOM;
+		settile(map, cost, key, ROOM);
+		inside = inland(g, key);
 		// then add borders around the room
-		for (i = -1; i < 2; i++)  // y coordinate offset
-			for (j = -1; j < 2; j++) // x coordinate offset
-				if ( (offset = offsetkey(key, i, j)) != INVALID )
-					if (map[offset] != ROOM) // if not a room
-						map[offset] = BORDER ; // then add a border
+		for (i = 1; i < ALLDIRS; i++) // each of the 8 neighbours
+			if ( (offset = inside ? key + g->step[i] : offsetkey(g, key, y(i), x(i))) != INVALID )
+				if (map[offset] != ROOM) // if not a room
+					settile(map, cost, offset, BORDER); // then add a border
 	}
 	return;
 }
 
+// writes a tile to the map and its move cost to the cost plane
+void settile(uint8_t map[], uint8_t cost[], int key, int tile)
+{
+	map[key] = tile;
+	cost[key] = get_move_cost(tile);
+	return;
+}
+
 
-// prints symbol on screen if coords on the map are true
-void printMap(int map[])
+// writes the map into buf as rows of symbols, one line per row.
+// buf needs room for height * (width + 1) chars, returns the number written
+int sprintMap(char *buf, const struct grid *g, const uint8_t map[])
 {
-	int i, j, val;
+	int i, j;
+	char *row = buf;
 
-	for (i = 0; i < HEIGHT_MAX; i++)
-		for (j = 0; j < WIDTH_MAX; j++)
-		{
-			val = map[hash(i, j)];
-			if (val)
-				mvaddch(i, j, getsymbol(val));
-		}
+	for (i = 0; i < g->height; i++, row += g->width + 1)
+	{
+		for (j = 0; j < g->width; j++)
+			row[j] = getsymbol(map[hash(g, i, j)]);
+		row[g->width] = '\n';
+	}
+	return row - buf;
+}
+
+// writes the map as rows of symbols, one line per row
+void fprintMap(FILE *fp, const struct grid *g, const uint8_t map[])
+{
+	char *row = malloc(g->width + 1);
+	int i, j;
+
+	row[g->width] = '\n';
+	for (i = 0; i < g->height; i++)
+	{
+		for (j = 0; j < g->width; j++)
+			row[j] = getsymbol(map[hash(g, i, j)]);
+		fwrite(row, 1, g->width + 1, fp); // one write per row rather than per cell
+	}
+	free(row);
 	return;
 }
 
-int getArea(int map[]) // sums up the map space
+int getArea(const struct grid *g, const uint8_t map[]) // sums up the map space
 {
 	int i;
 	int sum = 0;
-	for (i = 0; i < AREA; i++)
+	for (i = 0; i < g->size; i++)
 		if (map[i] == ROOM)
 			sum++;
 	return sum;
@@ -371,7 +944,7 @@ bool iscorner(int oy, int ox, struct room *r)
 			(oy == r->height + 1 && ox == r->width + 1);   // se corner
 }
 
-// given a tile type, returns the cost to move to that tile
+// given a tile type, returns the cost to move (or dig) to that tile
 int get_move_cost(int val)
 {
 	switch(val)
@@ -382,15 +955,47 @@ int get_move_cost(int val)
 }
 
 // populate the moveCost map to be fed into the pathfinding algorithm
-void populate_cost_map(int moveCost[], int map[])
+void populate_cost_map(const struct grid *g, uint8_t moveCost[], const uint8_t map[])
 {
 	int i;
 
-	for (i = 0; i < AREA; i++)
+	for (i = 0; i < g->size; i++)
 		moveCost[i] = get_move_cost(map[i]);
 	return;
 }
 
+// given a tile type, returns its TF_ flags
+int get_flags(int val)
+{
+	switch(val)
+	{
+		case ROOM: case CORRIDOR: case O_DOOR: case C_DOOR: case WATER:
+		case LINK: case UPSTAIRS: case DOWNSTAIRS: return TF_WALK;
+		default: return 0;
+	}
+}
+
+// populate the flag plane, what creatures can do on each tile
+void populate_flags(const struct grid *g, uint8_t flags[], const uint8_t map[])
+{
+	int i;
+
+	for (i = 0; i < g->size; i++)
+		flags[i] = get_flags(map[i]);
+	return;
+}
+
+// changes a tile of a finished level, e.g. a door opening, keeping its cost
+// and flags in step. Bumps the version, distance maps built before are
+// stale until repaired with dmap_repair
+void dungeon_settile(struct dungeon *d, int key, int tile)
+{
+	settile(d->map, d->cost, key, tile);
+	d->flags[key] = get_flags(tile);
+	d->version++;
+	return;
+}
+
 
 /*
 // prints a rectangle at origin key, for width and height of rectangle
@@ -0,0 +1,77 @@
+// interactive front end
+// generates one dungeon and shows it in an ncurses window
+// the only file that depends on the terminal
+
+#include <ncurses.h>
+#include "rl.h"
+
+void printMap(const struct grid *g, const uint8_t map[]); // prints symbol on screen if coords on the map are true
+
+int main(int argc, char *argv[])
+{
+	struct dungeon d;
+	int height = HEIGHT_DEFAULT, width = WIDTH_DEFAULT, layout = LAYOUT_ROWS;
+	uint64_t seed = time(0), level = 0;
+	int pathfinder = PF_ASTAR, planner = PLAN_CHAIN, placement = PLACE_SCATTER, density = 0, corridors = CORR_SERIAL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "h:w:l:p:c:r:d:e:s:k:")) != -1)
+		switch (opt)
+		{
+			case 'h': height = atoi(optarg); break;
+			case 'w': width = atoi(optarg); break;
+			case 'l': layout = parse_layout(optarg); break;
+			case 'p': pathfinder = parse_pathfinder(optarg); break;
+			case 'c': planner = parse_planner(optarg); break;
+			case 'r': placement = parse_placement(optarg); break;
+			case 'd': density = atoi(optarg); break;
+			case 'e': corridors = parse_corridors(optarg); break;
+			case 's': seed = strtoull(optarg, NULL, 10); break;
+			case 'k': level = strtoull(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-h height] [-w width] [-l rows|tiles] [-p astar|jps] [-c chain|mst|loops] [-r scatter|packed] [-d density] [-e serial|batch|speculate] [-s seed] [-k level]\n", argv[0]);
+				return 1;
+		}
+	if (layout == INVALID || pathfinder == INVALID || planner == INVALID || placement == INVALID ||
+			corridors == INVALID || (density && set_density(density) == FAILURE))
+	{
+		fprintf(stderr, "layout must be rows or tiles, pathfinder astar or jps, planner chain, mst or loops,\n"
+				"placement scatter or packed, density 1 .. 100, corridors serial, batch or speculate\n");
+		return 1;
+	}
+	set_pathfinder(pathfinder);
+	set_planner(planner);
+	set_placement(placement);
+	set_corridors(corridors);
+	set_lookahead(sched_cores()); // one level, every core can search ahead
+	if (dungeon_init(&d, height, width, layout) == FAILURE)
+	{
+		fprintf(stderr, "map must be between %dx%d and %dx%d\n", MAP_MIN, MAP_MIN, MAP_MAX, MAP_MAX);
+		return 1;
+	}
+	generate(&d, seed, level);
+	initscr(); // initalize ncurses window
+	printMap(&d.grid, d.map);
+	printw("%d", getArea(&d.grid, d.map));
+	refresh();
+	getch();
+	endwin();
+	dungeon_free(&d);
+
+	return 0;
+}
+
+// prints symbol on screen if coords on the map are true
+void printMap(const struct grid *g, const uint8_t map[])
+{
+	int i, j, val;
+
+	for (i = 0; i < g->height; i++)
+		for (j = 0; j < g->width; j++)
+		{
+			val = map[hash(g, i, j)];
+			if (val)
+				mvaddch(i, j, getsymbol(val));
+		}
+	return;
+}
@@ -1,65 +1,178 @@
 // Utility functions
 #include "rl.h"
 
+#ifndef __SIZEOF_INT128__
+// without a 128 bit product keys are split by a reciprocal scaled by 2^40.
+// A key times the pitch stays below MAP_MAX^3 = 2^36, which keeps the
+// quotient exact, and the 64 bit product below 2^52
+#define PITCH_SHIFT		40
+#endif
+
+// describe a height x width map, FAILURE if the dimensions are out of range
+bool grid_init(struct grid *g, int height, int width, int layout)
+{
+	int i;
+
+	if (height < MAP_MIN || width < MAP_MIN || height > MAP_MAX || width > MAP_MAX)
+		return FAILURE;
+	g->height = height;
+	g->width = width;
+	g->area = height * width;
+	g->layout = layout;
+	if (layout == LAYOUT_TILES)
+	{ // whole tiles, the ones on the right and bottom edges are padded out
+		g->pitch = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+		g->size = g->pitch * ((height + TILE_SIZE - 1) >> TILE_SHIFT) << (TILE_SHIFT * 2);
+	}
+	else if (layout == LAYOUT_ROWS)
+	{
+		g->pitch = width;
+		g->size = g->area;
+	}
+	else
+		return FAILURE;
+#ifdef __SIZEOF_INT128__
+	g->magic = UINT64_MAX / g->pitch + 1;
+#else
+	g->magic = ((uint64_t) 1 << PITCH_SHIFT) / g->pitch + 1;
+#endif
+	for (i = 0; i < ALLDIRS; i++)
+		g->step[i] = layout == LAYOUT_TILES ? y(i) * TILE_SIZE + x(i) : y(i) * g->pitch + x(i);
+	return SUCCESS;
+}
+
+// layout for a name given on the command line, INVALID if unknown
+int parse_layout(const char *name)
+{
+	if (strcmp(name, "rows") == 0)
+		return LAYOUT_ROWS;
+	else if (strcmp(name, "tiles") == 0)
+		return LAYOUT_TILES;
+	else
+		return INVALID;
+}
+
+// allocates a zeroed map buffer with one int per key of the grid
+int *newmap(const struct grid *g)
+{
+	return calloc(g->size, sizeof(int));
+}
+
+// allocates a zeroed plane with one byte per key of the grid, for tiles,
+// costs and flags
+uint8_t *newplane(const struct grid *g)
+{
+	return calloc(g->size, sizeof(uint8_t));
+}
+
+// n / pitch for any key, a multiply by the grid's reciprocal instead of a division.
+// GCC and Clang have a 128 bit product, other compilers take the 64 bit one
+static int divpitch(const struct grid *g, int n)
+{
+#ifdef __SIZEOF_INT128__
+	return ((unsigned __int128) g->magic * (uint32_t) n) >> 64;
+#else
+	return (g->magic * (uint32_t) n) >> PITCH_SHIFT;
+#endif
+}
+
 // returns a key from y and x
-int hash(int y, int x)
+// LAYOUT_ROWS: row after row
+// LAYOUT_TILES: tile after tile, each tile is TILE_SIZE rows of TILE_SIZE cells
+int hash(const struct grid *g, int y, int x)
 {
-    return x * HEIGHT_MAX + y;
+	if (g->layout == LAYOUT_ROWS)
+		return y * g->pitch + x;
+	return ((y >> TILE_SHIFT) * g->pitch + (x >> TILE_SHIFT)) << (TILE_SHIFT * 2) |
+			(y & (TILE_SIZE - 1)) << TILE_SHIFT | (x & (TILE_SIZE - 1));
 }
 
 // given a key, derive the y coordinate
-int gety(int key)
+int gety(const struct grid *g, int key)
 {
-    return key - HEIGHT_MAX * getx(key);
+	if (g->layout == LAYOUT_ROWS)
+		return divpitch(g, key);
+	return divpitch(g, key >> (TILE_SHIFT * 2)) << TILE_SHIFT | (key >> TILE_SHIFT & (TILE_SIZE - 1));
 }
 
 // given a key, derive the x coordinate
-int getx(int key)
+int getx(const struct grid *g, int key)
 {
-    return key / HEIGHT_MAX; // truncates decimal because it returns an int
+	int tile;
+
+	if (g->layout == LAYOUT_ROWS)
+		return key - divpitch(g, key) * g->pitch;
+	tile = key >> (TILE_SHIFT * 2);
+	return (tile - divpitch(g, tile) * g->pitch) << TILE_SHIFT | (key & (TILE_SIZE - 1));
 }
 
 // returns a key transformed from the given key and the x and y offset values
-int offsetkey(int key, int y, int x)
+int offsetkey(const struct grid *g, int key, int y, int x)
 {
-    int oy = gety(key); // origin y
-    int ox = getx(key); // origin x
+    int oy = gety(g, key); // origin y
+    int ox = getx(g, key); // origin x
  
-    if (oy + y >= HEIGHT_MAX || ox + x >= WIDTH_MAX || oy + y < 0 || ox + x < 0)
+    if (oy + y >= g->height || ox + x >= g->width || oy + y < 0 || ox + x < 0)
         return INVALID; // if key is invalid, hash won't work
     else
-    	return hash(oy + y, ox + x); 
+    	return hash(g, oy + y, ox + x); 
+}
+
+// returns whether all 8 neighbours of key are on the map and its step[] away,
+// so the pathfinders can step to them without offsetkey. The map's outer
+// ring stands in for a border of sentinels: those cells, and with tiles the
+// cells on the edge of their tile, take the checked path. One split of the
+// key, where offsetkey splits it for every neighbour
+bool inland(const struct grid *g, int key)
+{
+	int y, x, tile, ty;
+
+	if (g->layout == LAYOUT_ROWS)
+	{
+		y = divpitch(g, key);
+		x = key - y * g->pitch;
+		return (unsigned) (y - 1) < (unsigned) (g->height - 2) && (unsigned) (x - 1) < (unsigned) (g->width - 2);
+	}
+	y = key >> TILE_SHIFT & (TILE_SIZE - 1);
+	x = key & (TILE_SIZE - 1);
+	if ((unsigned) (y - 1) >= TILE_SIZE - 2 || (unsigned) (x - 1) >= TILE_SIZE - 2)
+		return false; // a neighbour is in the next tile
+	tile = key >> (TILE_SHIFT * 2);
+	ty = divpitch(g, tile);
+	y |= ty << TILE_SHIFT;
+	x |= (tile - ty * g->pitch) << TILE_SHIFT;
+	return y + 1 < g->height && x + 1 < g->width; // not next to the padding of an edge tile
 }
 
 // returns whether a key is invalid or not - not used currently
-int isvalid_key(int key, int y, int x)
+int isvalid_key(const struct grid *g, int key, int y, int x)
 {
-    int oy = gety(key); // origin y
-    int ox = getx(key); // origin x
+    int oy = gety(g, key); // origin y
+    int ox = getx(g, key); // origin x
  
-    if (oy + y > HEIGHT_MAX || ox + x > WIDTH_MAX || oy + y < 0 || ox + x < 0)
+    if (oy + y > g->height || ox + x > g->width || oy + y < 0 || ox + x < 0)
         return false; // key is not within dimensions
     else
     	return true; // key is valid
 }
 
 // measures the manhattan distance between two keys
-int howfar(int from, int to)
+int howfar(const struct grid *g, int from, int to)
 {
-	return abs(getx(from) - getx(to)) + abs(gety(from) - gety(to));
+	return abs(getx(g, from) - getx(g, to)) + abs(gety(g, from) - gety(g, to));
 }
 
 
 // rolls ndx dice
-int roll(int ndice, int faces)
+int roll(struct rng *r, int ndice, int faces)
 {
-	return rand() % faces + ndice;
+	return rng_below(r, faces) + ndice;
 }
 
 // rolls a result between min and max number
-int randint(int min, int max)
+int randint(struct rng *r, int min, int max)
 {
-	return rand() % max + min;
+	return rng_below(r, max) + min;
 }
 
 // returns whether an integer is even or odd
@@ -97,57 +210,126 @@ float probsucc(int a, int d)
 }
 
 // copy contents of an int array from one to another
-void arrcpy(int from[], int to[])
+void arrcpy(const struct grid *g, int from[], int to[])
 {
-	int i;
+	memcpy(to, from, g->size * sizeof(int));
+	return;
+}
+
+
+// log size a draft starts with, enough for the largest room with its borders
+#define DRAFT_LOG		256
 
-	for (i = 0; i < AREA; i++)
-		to[i] = from[i];
+// starts an empty draft on map
+bool draft_init(struct draft *t, uint8_t map[])
+{
+	t->map = map;
+	t->n = 0;
+	t->cap = DRAFT_LOG;
+	t->keys = malloc(t->cap * sizeof(int));
+	t->old = malloc(t->cap * sizeof(uint8_t));
+	if (!t->keys || !t->old)
+	{
+		draft_free(t);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
 
+// frees the draft's log, the map belongs to the caller
+void draft_free(struct draft *t)
+{
+	free(t->keys);
+	free(t->old);
+	t->keys = NULL;
+	t->old = NULL;
+	t->n = t->cap = 0;
 	return;
 }
 
+// writes val to the map, logging the value it replaces. FAILURE, with
+// nothing written, if the log can't grow; the draft can still be rolled back
+bool draft_set(struct draft *t, int key, int val)
+{
+	int *keys;
+	uint8_t *old;
+
+	if (t->n == t->cap)
+	{ // grow the log, rare since rooms are small
+		if (!(keys = realloc(t->keys, t->cap * 2 * sizeof(int))))
+			return FAILURE;
+		t->keys = keys;
+		if (!(old = realloc(t->old, t->cap * 2 * sizeof(uint8_t))))
+			return FAILURE;
+		t->old = old;
+		t->cap *= 2;
+	}
+	t->keys[t->n] = key;
+	t->old[t->n++] = t->map[key];
+	t->map[key] = val;
+	return SUCCESS;
+}
 
-// add room to room list
-void roomlist_append(struct room **list, struct room *r)
+// keeps every write since the last commit
+void draft_commit(struct draft *t)
 {
-	struct room *curr;
-	struct room *new = malloc(sizeof(struct room));
-	copyRoom(r, new);
+	t->n = 0;
+	return;
+}
 
-	if (*list) // if list has members
+// undoes every write since the last commit, newest first so a cell
+// written twice ends up with its original value
+void draft_rollback(struct draft *t)
+{
+	while (t->n > 0)
 	{
-		for (curr = *list; curr->next != NULL; curr = curr->next)
-			;
-		curr->next = new;	
+		t->n--;
+		t->map[t->keys[t->n]] = t->old[t->n];
 	}
-	else
-		*list = new; // if list is empty, start a new list
 	return;
 }
 
-// frees all rooms in the room list
-void roomlist_purge(struct room **list)
+// starts an empty room list
+void roomlist_init(struct roomlist *list)
+{
+	list->head = list->tail = NULL;
+	list->n = 0;
+	pool_init(&list->pool, sizeof(struct room), 64);
+	return;
+}
+
+// frees the list's rooms and their pool
+void roomlist_free(struct roomlist *list)
+{
+	pool_free(&list->pool);
+	list->head = list->tail = NULL;
+	list->n = 0;
+	return;
+}
+
+// add a copy of room r to the end of the room list
+void roomlist_append(struct roomlist *list, struct room *r)
 {
-    struct room *curr;
+	struct room *new = pool_alloc(&list->pool);
+
+	copyRoom(r, new);
+	new->next = NULL;
+	if (list->tail) // if list has members
+		list->tail->next = new;
+	else
+		list->head = new; // if list is empty, start a new list
+	list->tail = new;
+	list->n++;
+	return;
+}
 
-    if ( (*list) == NULL) // if queue is empty, return
-        return;
-    else if ( (*list)->next == NULL) // if only 1 member in queue, free ref and point to NULL
-    {
-        free(*list);
-        *list = NULL;
-        return;
-    }
-    else // if more than 1 member in the queue
-    {
-        for (curr = *list; curr->next->next != NULL; curr = curr->next)
-            ;
-        free(curr->next);
-        curr->next = NULL;
-    }
-    roomlist_purge(list); // recur until list == NULL
-    return;
+// empties the room list, every room goes back to the pool at once
+void roomlist_purge(struct roomlist *list)
+{
+	pool_reset(&list->pool);
+	list->head = list->tail = NULL;
+	list->n = 0;
+	return;
 }
 
 // copies the contents of one room to another
@@ -171,50 +353,42 @@ int room_listlen(struct room *list)
 	return cnt;
 }
 
-// add room to room list
-void nodelist_append(struct node **list, int key)
+// add node with key after tail, the link to write it to (&list when the
+// list is empty), and returns the link of the new node, the new tail
+struct node **nodelist_append(struct pool *p, struct node **tail, int key)
 {
-	struct node *curr;
-	struct node *new = malloc(sizeof(struct node));
+	struct node *new = pool_alloc(p);
+
 	new->key = key;
 	new->next = NULL;
 	new->priority = 0;
+	*tail = new;
+	return &new->next;
+}
 
-	if (*list) // if list has members
-	{
-		for (curr = *list; curr->next != NULL; curr = curr->next)
-			;
-		curr->next = new; // append list
-	}
-	else
-	{
-		*list = new; // if list is empty, start a new list
-	}
+// add node to the front of the node list
+void nodelist_prepend(struct pool *p, struct node **list, int key)
+{
+	struct node *new = pool_alloc(p);
+
+	new->key = key;
+	new->next = *list;
+	new->priority = 0;
+	*list = new;
 	return;
 }
 
-// frees all rooms in the room list
-void nodelist_purge(struct node **list)
-{
-    struct node *curr;
-
-    if ( (*list) == NULL) // if queue is empty, return
-        return;
-    else if ( (*list)->next == NULL) // if only 1 member in queue, free ref and point to NULL
-    {
-        free(*list);
-        *list = NULL;
-        return;
-    }
-    else // if more than 1 member in the queue
-    {
-        for (curr = *list; curr->next->next != NULL; curr = curr->next)
-            ;
-        free(curr->next);
-        curr->next = NULL;
-    }
-    nodelist_purge(list); // recur until list == NULL
-    return;
+// gives every node in the node list back to the pool
+void nodelist_purge(struct pool *p, struct node **list)
+{
+	struct node *next;
+
+	for (; *list; *list = next)
+	{
+		next = (*list)->next;
+		pool_release(p, *list);
+	}
+	return;
 }
 
 // counts all the members in a linked list